@@ -0,0 +1,91 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ojph_arch.h"
+#include "coding_units.hpp"
+#include "ht_block_decoding.hpp"
+#include "ht_block_encoding.hpp"
+#include "KernelsOpenHTJ2K.h"
+
+namespace openhtj2k
+{
+static void copy_block_generic(const int32_t* src, uint32_t src_stride, int32_t* dest,
+							   uint32_t width, uint32_t height)
+{
+	for(uint32_t j = 0; j < height; ++j)
+	{
+		for(uint32_t i = 0; i < width; ++i)
+			*dest++ = src[i];
+		src += src_stride;
+	}
+}
+static void scale_block_generic(const int32_t* src, uint32_t src_stride, int32_t* dest,
+								uint32_t width, uint32_t height, float inv_step)
+{
+	for(uint32_t j = 0; j < height; ++j)
+	{
+		for(uint32_t i = 0; i < width; ++i)
+			*dest++ = (int32_t)((float)src[i] * inv_step);
+		src += src_stride;
+	}
+}
+static void roi_shift_generic(int32_t* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+							  uint32_t shift)
+{
+	int32_t thresh = 1 << roiShift;
+	for(uint32_t i = 0; i < len; ++i)
+	{
+		int32_t val = src[i];
+		int32_t mag = (val & 0x7FFFFFFF);
+		if(mag >= thresh)
+			val = (int32_t)(((uint32_t)mag >> roiShift) & ((uint32_t)val & 0x80000000));
+		int32_t val_shifted = (val & 0x7FFFFFFF) >> shift;
+		dest[i] = ((uint32_t)val & 0x80000000) ? -val_shifted : val_shifted;
+	}
+}
+static void to_float_generic(float* dest, const int32_t* src, uint32_t len)
+{
+	for(uint32_t i = 0; i < len; ++i)
+		dest[i] = (float)src[i];
+}
+
+static KernelsOpenHTJ2K selectKernels()
+{
+	KernelsOpenHTJ2K k;
+	k.decode = htj2k_decode;
+	k.cleanup_encode = htj2k_cleanup_encode;
+	k.copy_block = copy_block_generic;
+	k.scale_block = scale_block_generic;
+	k.roi_shift = roi_shift_generic;
+	k.to_float = to_float_generic;
+	// detection, and the HTJ2K_CPU_EXT_LEVEL override, are shared with the
+	// OpenJPH backend so that both backends run at the same level
+	k.cpu_ext_level = ojph::get_cpu_ext_level();
+#ifdef OJPH_ENABLE_INTEL_SIMD
+	if(k.cpu_ext_level >= ojph::X86_CPU_EXT_LEVEL_AVX2)
+		k.decode = htj2k_decode_avx2;
+#endif
+
+	return k;
+}
+const KernelsOpenHTJ2K& getKernelsOpenHTJ2K()
+{
+	static const KernelsOpenHTJ2K kernels = selectKernels();
+	return kernels;
+}
+
+} // namespace openhtj2k
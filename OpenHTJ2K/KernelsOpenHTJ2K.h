@@ -0,0 +1,60 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class j2k_codeblock;
+struct ht_enc_workspace;
+struct ht_dec_workspace;
+
+namespace openhtj2k
+{
+/**
+ * Kernels used by the OpenHTJ2K backend, one entry per hot loop. Each entry
+ * holds the fastest implementation supported by the CPU, or by the level
+ * forced through HTJ2K_CPU_EXT_LEVEL; the table is filled once per process.
+ */
+struct KernelsOpenHTJ2K
+{
+	// HT block decoder: cleanup, SigProp and MagRef passes, followed by
+	// dequantization when dequant is set, working in the caller's reusable
+	// workspace
+	bool (*decode)(j2k_codeblock* block, uint8_t ROIshift, bool dequant, ht_dec_workspace* work);
+	// HT cleanup pass encoder, working in the caller's reusable workspace
+	int32_t (*cleanup_encode)(j2k_codeblock* block, uint8_t ROIshift, ht_enc_workspace* work);
+	// tile samples to the codeblock buffer, copied for the reversible path and
+	// multiplied by the inverse step for the irreversible one; src is strided,
+	// dest is contiguous. Sign-magnitude conversion follows in the encoder.
+	void (*copy_block)(const int32_t* src, uint32_t src_stride, int32_t* dest, uint32_t width,
+					   uint32_t height);
+	void (*scale_block)(const int32_t* src, uint32_t src_stride, int32_t* dest, uint32_t width,
+						uint32_t height, float inv_step);
+	// post-T1 filters with ROI: sign-magnitude to two's complement integers or
+	// floats. Without ROI, the decoder dequantizes the samples itself.
+	void (*roi_shift)(int32_t* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+					  uint32_t shift);
+	void (*to_float)(float* dest, const int32_t* src, uint32_t len);
+
+	// X86_CPU_EXT_LEVEL_* the table was selected for
+	int cpu_ext_level;
+};
+
+const KernelsOpenHTJ2K& getKernelsOpenHTJ2K();
+
+} // namespace openhtj2k
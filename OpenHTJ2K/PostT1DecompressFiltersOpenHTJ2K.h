@@ -1,6 +1,7 @@
 #pragma once
 
 #include "grk_includes.h"
+#include "KernelsOpenHTJ2K.h"
 
 namespace openhtj2k
 {
@@ -9,26 +10,21 @@ class RoiShiftOpenHTJ2KFilter
 {
   public:
 	RoiShiftOpenHTJ2KFilter(grk::DecompressBlockExec* block)
-		: roiShift(block->roishift), shift(31U - (block->k_msbs + 1U))
+		: roiShift(block->roishift), shift(31U - (block->k_msbs + 1U)),
+		  kernels(getKernelsOpenHTJ2K())
 	{}
 	inline void copy(T* dest, T* src, uint32_t len)
 	{
-		T thresh = 1 << roiShift;
-		for(uint32_t i = 0; i < len; ++i)
-		{
-			T val = src[i];
-			T mag = (val & 0x7FFFFFFF);
-			if(mag >= thresh)
-				val = (T)(((uint32_t)mag >> roiShift) & ((uint32_t)val & 0x80000000));
-			int32_t val_shifted = (val & 0x7FFFFFFF) >> shift;
-			dest[i] = (int32_t)(((uint32_t)val & 0x80000000) ? -val_shifted : val_shifted);
-		}
+		kernels.roi_shift((int32_t*)dest, (const int32_t*)src, len, roiShift, shift);
 	}
 
   private:
 	uint32_t roiShift;
 	uint32_t shift;
+	const KernelsOpenHTJ2K& kernels;
 };
+// Without ROI, T1OpenHTJ2K has the block decoder write final two's complement
+// samples, so this filter only copies them into the tile
 template<typename T>
 class ShiftOpenHTJ2KFilter
 {
@@ -36,10 +32,7 @@ class ShiftOpenHTJ2KFilter
 	ShiftOpenHTJ2KFilter([[maybe_unused]] grk::DecompressBlockExec* block) {}
 	inline void copy(T* dest, T* src, uint32_t len)
 	{
-		for(uint32_t i = 0; i < len; ++i)
-		{
-			dest[i] = src[i];
-		}
+		memcpy(dest, src, len * sizeof(T));
 	}
 };
 
@@ -47,35 +40,29 @@ template<typename T>
 class RoiScaleOpenHTJ2KFilter
 {
   public:
-	RoiScaleOpenHTJ2KFilter([[maybe_unused]] grk::DecompressBlockExec* block) {}
+	RoiScaleOpenHTJ2KFilter([[maybe_unused]] grk::DecompressBlockExec* block)
+		: kernels(getKernelsOpenHTJ2K())
+	{}
 	inline void copy(T* dest, T* src, uint32_t len)
 	{
-		for(uint32_t i = 0; i < len; ++i)
-		{
-			((float*)dest)[i] = src[i];
-		}
+		kernels.to_float((float*)dest, (const int32_t*)src, len);
 	}
+
+  private:
+	const KernelsOpenHTJ2K& kernels;
 };
 
+// Without ROI, T1OpenHTJ2K has the block decoder write final scaled floats,
+// so this filter only copies them into the tile
 template<typename T>
 class ScaleOpenHTJ2KFilter
 {
   public:
-	ScaleOpenHTJ2KFilter(grk::DecompressBlockExec* block)
-		: scale(block->stepsize / (float)(1u << (31 - (block->k_msbs + 1))))
-	{
-		assert(block->bandNumbps <= 31);
-	}
+	ScaleOpenHTJ2KFilter([[maybe_unused]] grk::DecompressBlockExec* block) {}
 	inline void copy(T* dest, T* src, uint32_t len)
 	{
-		for(uint32_t i = 0; i < len; ++i)
-		{
-			((float*)dest)[i] = src[i] * scale;
-		}
+		memcpy(dest, src, len * sizeof(T));
 	}
-
-  private:
-	float scale;
 };
 
 } // namespace openhtj2k
@@ -20,6 +20,7 @@
 #include "ht_block_decoding.hpp"
 #include "ht_block_encoding.hpp"
 #include "T1OpenHTJ2K.h"
+#include "T1HT.h"
 #include "grk_includes.h"
 
 const uint8_t grk_cblk_dec_compressed_data_pad_ht = 8U;
@@ -30,12 +31,20 @@ T1OpenHTJ2K::T1OpenHTJ2K(bool isCompressor, [[maybe_unused]] grk::TileCodingPara
 						 uint32_t maxCblkW, uint32_t maxCblkH)
 	: coded_data_size(isCompressor ? 0 : (uint32_t)(maxCblkW * maxCblkH * sizeof(int32_t))),
 	  coded_data(isCompressor ? nullptr : new uint8_t[coded_data_size]),
-	  unencoded_data_size(maxCblkW * maxCblkH), unencoded_data(new int32_t[unencoded_data_size])
+	  unencoded_data_size(maxCblkW * maxCblkH), unencoded_data(new int32_t[unencoded_data_size]),
+	  encode_work(isCompressor ? new ht_enc_workspace : nullptr),
+	  decode_work(isCompressor ? nullptr : new ht_dec_workspace),
+	  codeblock(new j2k_codeblock(0, 0, 0, 0, 0, 0.0f, maxCblkW, (uint32_t*)unencoded_data, 0, 1, 0,
+								  element_siz(), element_siz(), element_siz(maxCblkW, maxCblkH))),
+	  kernels(getKernelsOpenHTJ2K())
 {}
 T1OpenHTJ2K::~T1OpenHTJ2K()
 {
 	delete[] coded_data;
 	delete[] unencoded_data;
+	delete encode_work;
+	delete decode_work;
+	delete codeblock;
 }
 void T1OpenHTJ2K::preCompress([[maybe_unused]] grk::CompressBlockExec* block,
 							  [[maybe_unused]] grk::Tile* tile)
@@ -45,58 +54,41 @@ void T1OpenHTJ2K::preCompress([[maybe_unused]] grk::CompressBlockExec* block,
 	uint16_t h = (uint16_t)cblk->height();
 	uint32_t tile_width =
 		(tile->comps + block->compno)->getWindow()->getResWindowBufferHighestStride();
-	auto tileLineAdvance = (int32_t)(tile_width - w);
-	uint32_t cblk_index = 0U;
 
-	// convert to sign-magnitude
 	if((int8_t)block->qmfbid == 1)
-	{
-		auto tiledp = block->tiledp;
-		for(auto j = 0U; j < h; ++j)
-		{
-			for(auto i = 0U; i < w; ++i)
-			{
-				unencoded_data[cblk_index] = (int32_t)*tiledp++;
-				cblk_index++;
-			}
-			tiledp += tileLineAdvance;
-		}
-	}
+		kernels.copy_block(block->tiledp, tile_width, unencoded_data, w, h);
 	else
-	{
-		auto tiledp = block->tiledp;
-		for(auto j = 0U; j < h; ++j)
-		{
-			for(auto i = 0U; i < w; ++i)
-			{
-				unencoded_data[cblk_index] = (int32_t)((float)*tiledp++ * block->inv_step_ht);
-				cblk_index++;
-			}
-			tiledp += tileLineAdvance;
-		}
-	}
+		kernels.scale_block(block->tiledp, tile_width, unencoded_data, w, h, block->inv_step_ht);
 }
 bool T1OpenHTJ2K::compress(grk::CompressBlockExec* block)
 {
 	preCompress(block, block->tile);
 	auto cblk = block->cblk;
-	uint32_t idx;
-	uint16_t numlayers = 1;
 	uint8_t codelbock_style = (uint8_t)block->cblk_sty;
 	const element_siz p0;
 	const element_siz p1;
 	const element_siz s(cblk->width(), cblk->height());
-	auto j2k_block =
-		new j2k_codeblock(idx, block->bandOrientation, 0, 0, 0, 0, cblk->width(), /*unencoded_data,*/
-						  (uint32_t*)unencoded_data, 0, numlayers, codelbock_style, p0, p1, s);
-	auto len = htj2k_cleanup_encode(j2k_block, 0);
+	// the transformation tells the encoder how to estimate distortion
+	auto j2k_block = codeblock;
+	j2k_block->reset(0, block->bandOrientation, 0, 0, (uint8_t)block->qmfbid, 0, cblk->width(),
+					 (uint32_t*)unencoded_data, 0, codelbock_style, p0, p1, s);
+	auto len = kernels.cleanup_encode(j2k_block, 0, encode_work);
+	// an all-zero codeblock is left without coding passes
+	if(!j2k_block->num_passes)
+	{
+		cblk->numPassesTotal = 0;
+		cblk->numbps = 0;
+		return true;
+	}
 	cblk->numPassesTotal = 1;
 	cblk->passes[0].len = (uint16_t)len;
 	cblk->passes[0].rate = (uint16_t)len;
+	// the encoder reports distortion in units of the squared quantization step
+	cblk->passes[0].distortiondec =
+		(double)j2k_block->pass_distortion[0] * t1ht::distortionWeight(block);
 	cblk->numbps = 1;
 	assert(cblk->paddedCompressedStream);
 	memcpy(cblk->paddedCompressedStream, j2k_block->get_compressed_data(), (size_t)len);
-	delete j2k_block;
 
 	return true;
 }
@@ -122,48 +114,57 @@ bool T1OpenHTJ2K::decompress(grk::DecompressBlockExec* block)
 			offset += b->len;
 		}
 
-		size_t num_passes = 0;
-		for(uint32_t i = 0; i < cblk->getNumSegments(); ++i)
+		t1ht::HTSegments segments;
+		if(!t1ht::getHTSegments(block, segments))
+			return false;
+		if(segments.lengths1 + segments.lengths2 > UINT16_MAX)
 		{
-			auto sgrk = cblk->getSegment(i);
-			num_passes += sgrk->numpasses;
+			grk::GRK_ERROR("HT codeblock data exceeds 65535 bytes");
+			return false;
 		}
+		uint32_t num_passes = segments.num_passes;
 
-		if(num_passes && offset)
-		{
-			auto cblk = block->cblk;
-			uint32_t idx;
-			uint16_t numlayers = 1;
-			uint8_t codelbock_style = (uint8_t)block->cblk_sty;
-			const element_siz p0;
-			const element_siz p1;
-			const element_siz s(cblk->width(), cblk->height());
-			auto j2k_block =
-				new j2k_codeblock(idx, block->bandOrientation, (uint8_t)(block->k_msbs + 1U), block->R_b,
-								  block->qmfbid, block->stepsize, cblk->width(), /*unencoded_data,*/
-								  (uint32_t*)unencoded_data, 0, numlayers, codelbock_style, p0, p1, s);
-            j2k_block->num_passes = static_cast<uint8_t>(num_passes);
-            //j2k_block->layer_passes[0] = static_cast<uint8_t>(j2k_block->layer_passes[0]);
-            j2k_block->num_ZBP = static_cast<uint8_t>(block->k_msbs);
-            j2k_block->length = static_cast<unsigned int>(offset);
-            j2k_block->pass_length[0] = static_cast<unsigned int>(offset);
-            j2k_block->pass_length[1] = 0;
-            j2k_block->pass_length[2] = 0;
-            j2k_block->set_compressed_data(coded_data, static_cast<uint16_t>(offset));
-
-            int32_t Lcup = static_cast<int32_t>(j2k_block->pass_length[0]);
-            uint8_t *Dcup = j2k_block->get_compressed_data();
-            const int32_t Scup = static_cast<int32_t>((Dcup[Lcup - 1] << 4) + (Dcup[Lcup - 2] & 0x0F));
-            Dcup[Lcup - 1] = 0xFF;
-            Dcup[Lcup - 2] |= 0x0F;
-            const int32_t Pcup = static_cast<int32_t>(Lcup - Scup);
+		if(num_passes)
+		{
+			uint8_t codelbock_style = (uint8_t)block->cblk_sty;
+			const element_siz p0;
+			const element_siz p1;
+			const element_siz s(cblk->width(), cblk->height());
+			auto j2k_block = codeblock;
+			j2k_block->reset(0, block->bandOrientation, (uint8_t)block->bandNumbps, block->R_b,
+							 (uint8_t)block->qmfbid, block->stepsize, cblk->width(),
+							 (uint32_t*)unencoded_data, 0, codelbock_style, p0, p1, s);
+			j2k_block->num_passes = (uint8_t)num_passes;
+			j2k_block->num_ZBP = (uint8_t)block->k_msbs;
+			j2k_block->length = segments.lengths1 + segments.lengths2;
+			// one entry per pass, holding the length of the segment that the
+			// pass starts
+			j2k_block->pass_length.assign(num_passes, 0);
+			j2k_block->pass_length[0] = segments.lengths1;
+			if(num_passes > 1)
+				j2k_block->pass_length[1] = segments.lengths2;
+			j2k_block->set_compressed_data(coded_data, (uint16_t)j2k_block->length);
 
-            ht_cleanup_decode(j2k_block, static_cast<uint8_t>(30 - (block->k_msbs)), Lcup, 0, 0);
-            delete j2k_block;
+			// without ROI the decoder dequantizes the samples, and the
+			// Shift/Scale filters are left with a plain copy; with ROI the
+			// filters take the sign-magnitude samples
+			bool dequant = block->roishift == 0;
+			if(!kernels.decode(j2k_block, 0, dequant, decode_work))
+			{
+				grk::GRK_ERROR("Error in HT block coder");
+				return false;
+			}
+			if(!dequant)
+			{
+				for(uint32_t j = 0; j < cblk->height(); ++j)
+					memcpy(unencoded_data + (size_t)j * cblk->width(),
+						   j2k_block->sample_buf.get() + j * j2k_block->blksampl_stride,
+						   cblk->width() * sizeof(int32_t));
+			}
 		}
 		else
 		{
-			memset(unencoded_data, 0, (uint16_t)cblk->width() * cblk->height() * sizeof(int32_t));
+			memset(unencoded_data, 0, (size_t)cblk->width() * cblk->height() * sizeof(int32_t));
 		}
 	}
 
@@ -18,6 +18,7 @@
 #pragma once
 #include "T1Interface.h"
 #include "TileProcessor.h"
+#include "KernelsOpenHTJ2K.h"
 
 namespace openhtj2k
 {
@@ -41,5 +42,12 @@ class T1OpenHTJ2K : public grk::T1Interface
 	uint8_t* coded_data;
 	uint32_t unencoded_data_size;
 	int32_t* unencoded_data;
+	// encoder and decoder work memory, reused for every codeblock
+	ht_enc_workspace* encode_work;
+	ht_dec_workspace* decode_work;
+	// codeblock context, sized for the largest codeblock and reset for each one
+	j2k_codeblock* codeblock;
+
+	const KernelsOpenHTJ2K& kernels;
 };
 } // namespace openhtj2k
@@ -47,6 +47,9 @@ j2k_codeblock::j2k_codeblock(const uint32_t &idx, uint8_t orientation, uint8_t M
       size(s),
       // private
       compressed_data(nullptr),
+      compressed_capacity(0),
+      block_states_capacity(0),
+      sample_buf_capacity(0),
       current_address(nullptr),
       band(orientation),
       M_b(M_b),
@@ -65,27 +68,73 @@ j2k_codeblock::j2k_codeblock(const uint32_t &idx, uint8_t orientation, uint8_t M
       fast_skip_passes(0),
       Lblock(0),
       already_included(false),
-      refsegment(false) {
-  const uint32_t QWx2 = round_up(size.x, 8U);  // TODO: needs padding?
-  const uint32_t QHx2 = round_up(size.y, 8U);  // TODO: needs padding?
-  blksampl_stride = QWx2;
-  blkstate_stride = QWx2 + 2;
-  block_states    = MAKE_UNIQUE<uint8_t[]>(static_cast<size_t>(QWx2 + 2) * (QHx2 + 2));
-  memset(block_states.get(), 0, static_cast<size_t>(QWx2 + 2) * (QHx2 + 2));
-  sample_buf = MAKE_UNIQUE<int32_t[]>(static_cast<size_t>(QWx2 * QHx2));
-  memset(sample_buf.get(), 0, sizeof(int32_t) * QWx2 * QHx2);
+      refsegment(false),
+      pass_distortion{0.0f, 0.0f, 0.0f} {
+  init_buffers();
   this->layer_start  = MAKE_UNIQUE<uint8_t[]>(num_layers);
   this->layer_passes = MAKE_UNIQUE<uint8_t[]>(num_layers);
   if ((Cmodes & 0x40) == 0) this->pass_length.reserve(109);
   this->pass_length = std::vector<uint32_t>(num_layers, 0);  // critical section
 }
 
+// sizes block_states and sample_buf for the current size and clears them; the
+// buffers are only reallocated when they are too small
+void j2k_codeblock::init_buffers() {
+  const uint32_t QWx2 = round_up(size.x, 8U);  // TODO: needs padding?
+  const uint32_t QHx2 = round_up(size.y, 8U);  // TODO: needs padding?
+  blksampl_stride = QWx2;
+  blkstate_stride = QWx2 + 2;
+  const size_t num_states  = static_cast<size_t>(QWx2 + 2) * (QHx2 + 2);
+  const size_t num_samples = static_cast<size_t>(QWx2) * QHx2;
+  if (block_states_capacity < num_states) {
+    block_states          = MAKE_UNIQUE<uint8_t[]>(num_states);
+    block_states_capacity = num_states;
+  }
+  memset(block_states.get(), 0, num_states);
+  if (sample_buf_capacity < num_samples) {
+    sample_buf          = MAKE_UNIQUE<int32_t[]>(num_samples);
+    sample_buf_capacity = num_samples;
+  }
+  memset(sample_buf.get(), 0, sizeof(int32_t) * num_samples);
+}
+
+void j2k_codeblock::reset(const uint32_t &idx, uint8_t orientation, uint8_t Mb, uint8_t Rb,
+                          uint8_t transform, float step, uint32_t stride, uint32_t *ibuf,
+                          uint32_t offset, const uint8_t &codeblock_style, const element_siz &p0,
+                          const element_siz &p1, const element_siz &s) {
+  pos0             = p0;
+  pos1             = p1;
+  size             = s;
+  current_address  = nullptr;
+  band             = orientation;
+  M_b              = Mb;
+  index            = idx;
+  i_samples        = ibuf + offset;
+  band_stride      = stride;
+  R_b              = Rb;
+  transformation   = transform;
+  stepsize         = step;
+  length           = 0;
+  Cmodes           = codeblock_style;
+  num_passes       = 0;
+  num_ZBP          = 0;
+  fast_skip_passes = 0;
+  Lblock           = 0;
+  already_included = false;
+  refsegment       = false;
+  std::fill(pass_distortion, pass_distortion + 3, 0.0f);
+  init_buffers();
+  memset(layer_start.get(), 0, num_layers);
+  memset(layer_passes.get(), 0, num_layers);
+  pass_length.assign(num_layers, 0);
+}
+
 uint8_t j2k_codeblock::get_Mb() const { return this->M_b; }
 
 uint8_t *j2k_codeblock::get_compressed_data() { return this->compressed_data.get(); }
 
 void j2k_codeblock::set_compressed_data(uint8_t *const buf, const uint16_t bufsize, const uint16_t Lref) {
-  if (this->compressed_data != nullptr) {
+  if (this->current_address != nullptr) {
     if (!refsegment) {
       printf(
           "ERROR: illegal attempt to allocate codeblock's compressed data but the data is not "
@@ -96,7 +145,12 @@ void j2k_codeblock::set_compressed_data(uint8_t *const buf, const uint16_t bufsi
       return;
     }
   }
-  this->compressed_data = MAKE_UNIQUE<uint8_t[]>(static_cast<size_t>(bufsize + Lref * (refsegment)));
+  // a buffer left by an earlier block is reused when it is large enough
+  const size_t required = static_cast<size_t>(bufsize + Lref * (refsegment));
+  if (this->compressed_capacity < required) {
+    this->compressed_data     = MAKE_UNIQUE<uint8_t[]>(required);
+    this->compressed_capacity = required;
+  }
   memcpy(this->compressed_data.get(), buf, bufsize);
   this->current_address = this->compressed_data.get();
 }
@@ -36,7 +36,6 @@
 #include <memory>
 #include "utils.hpp"
 #include <cstring>
-#include <functional>
 
 /********************************************************************************
  * j2k_region
@@ -69,25 +68,31 @@ class j2k_region {
  *******************************************************************************/
 class j2k_codeblock : public j2k_region {
  public:
-  const element_siz size;
+  element_siz size;
 
  private:
   std::unique_ptr<uint8_t[]> compressed_data;
+  // bytes allocated for compressed_data, block_states and sample_buf, which
+  // reset() reuses when they are large enough
+  size_t compressed_capacity;
+  size_t block_states_capacity;
+  size_t sample_buf_capacity;
   uint8_t *current_address;
-  const uint8_t band;
-  const uint8_t M_b;
-  [[maybe_unused]] const uint32_t index;
+  uint8_t band;
+  uint8_t M_b;
+  [[maybe_unused]] uint32_t index;
+  void init_buffers();
 
  public:
   std::unique_ptr<int32_t[]> sample_buf;
   size_t blksampl_stride;
   std::unique_ptr<uint8_t[]> block_states;
   size_t blkstate_stride;
-  uint32_t *const i_samples;
-  const uint32_t band_stride;
-  [[maybe_unused]] const uint8_t R_b;
-  const uint8_t transformation;
-  const float stepsize;
+  uint32_t *i_samples;
+  uint32_t band_stride;
+  [[maybe_unused]] uint8_t R_b;
+  uint8_t transformation;
+  float stepsize;
 
   const uint16_t num_layers;
 
@@ -105,20 +110,34 @@ class j2k_codeblock : public j2k_region {
   std::unique_ptr<uint8_t[]> layer_passes;
   bool already_included;
   bool refsegment;
+  // reduction in squared error brought by each coding pass, in units of the
+  // squared quantization step
+  float pass_distortion[3];
 
   j2k_codeblock(const uint32_t &idx, uint8_t orientation, uint8_t M_b, uint8_t R_b, uint8_t transformation,
                 float stepsize, uint32_t band_stride, uint32_t *ibuf, uint32_t offset,
                 const uint16_t &numlayers, const uint8_t &codeblock_style, const element_siz &p0,
                 const element_siz &p1, const element_siz &s);
-  void modify_state(const std::function<void(uint8_t &, uint8_t)> &callback, uint8_t val, int16_t j1,
-                    int16_t j2) {
-    callback(block_states[static_cast<uint32_t>(j1 + 1) * (blkstate_stride) +
-                          static_cast<uint32_t>(j2 + 1)],
-             val);
+  // prepares the codeblock for another block, as the constructor would, but
+  // keeps its buffers when they are large enough; num_layers is unchanged
+  void reset(const uint32_t &idx, uint8_t orientation, uint8_t M_b, uint8_t R_b, uint8_t transformation,
+             float stepsize, uint32_t band_stride, uint32_t *ibuf, uint32_t offset,
+             const uint8_t &codeblock_style, const element_siz &p0, const element_siz &p1,
+             const element_siz &s);
+  // state byte of sample (j1, j2); block_states has a border of one sample
+  uint8_t &state(int16_t j1, int16_t j2) const {
+    return block_states[static_cast<uint32_t>(j1 + 1) * (blkstate_stride) + static_cast<uint32_t>(j2 + 1)];
   }
-  uint8_t get_state(const std::function<uint8_t(uint8_t &)> &callback, int16_t j1, int16_t j2) const {
-    return (uint8_t)callback(block_states[static_cast<uint32_t>(j1 + 1) * (blkstate_stride) +
-                                          static_cast<uint32_t>(j2 + 1)]);
+  // the setters and getters of coding_local.hpp are template arguments, so
+  // that they are inlined into the pass loops, e.g.
+  // modify_state<refinement_indicator>(1, i, j) or get_state<Sigma>(i, j)
+  template <void (*setter)(uint8_t &, const uint8_t &)>
+  void modify_state(uint8_t val, int16_t j1, int16_t j2) {
+    setter(state(j1, j2), val);
+  }
+  template <uint8_t (*getter)(uint8_t &)>
+  uint8_t get_state(int16_t j1, int16_t j2) const {
+    return getter(state(j1, j2));
   }
   // DEBUG FUNCTION, SOON BE DELETED
   [[maybe_unused]] [[nodiscard]] uint8_t get_orientation() const { return band; }
@@ -132,9 +151,12 @@ class j2k_codeblock : public j2k_region {
   void update_sample(const uint8_t &symbol, const uint8_t &p, const int16_t &j1, const int16_t &j2) const;
   void update_sign(const int8_t &val, const int16_t &j1, const int16_t &j2) const;
   [[nodiscard]] uint8_t get_sign(const int16_t &j1, const int16_t &j2) const;
-  void quantize(uint32_t &or_val) const;
+  void quantize(uint32_t &or_val, float &distortion) const;
   uint8_t calc_mbr(int16_t i, int16_t j, uint8_t causal_cond) const;
   void dequantize(uint8_t S_blk, uint8_t ROIshift) const;
+  // dequantize() with AVX2, eight samples at a time
+  void dequantize_avx2(uint8_t S_blk, uint8_t ROIshift) const;
 };
 
-int32_t htj2k_cleanup_encode(j2k_codeblock *block, uint8_t ROIshift) noexcept;
+struct ht_enc_workspace;
+int32_t htj2k_cleanup_encode(j2k_codeblock *block, uint8_t ROIshift, ht_enc_workspace *work) noexcept;
@@ -27,6 +27,7 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #if !defined(OPENHTJ2K_ENABLE_ARM_NEON) && !defined(__AVX2__)
+  #include "ojph_arch.h"
   #include "coding_units.hpp"
   #include "dec_CxtVLC_tables.hpp"
   #include "ht_block_decoding.hpp"
@@ -37,8 +38,6 @@
     #include <omp.h>
   #endif
 
-  #define Q0 0
-  #define Q1 1
 
 /********************************************************************************
  * SP_dec: state class for HT SigProp decoding
@@ -135,52 +134,36 @@ uint8_t MR_dec::importMagRefBit() {
 }
 
 uint8_t j2k_codeblock::calc_mbr(const int16_t i, const int16_t j, const uint8_t causal_cond) const {
-  const int16_t im1 = static_cast<int16_t>(i - 1);
-  const int16_t jm1 = static_cast<int16_t>(j - 1);
-  const int16_t ip1 = static_cast<int16_t>(i + 1);
-  const int16_t jp1 = static_cast<int16_t>(j + 1);
-  uint8_t mbr       = get_state(Sigma, im1, jm1);
-  mbr               = mbr | get_state(Sigma, im1, j);
-  mbr               = mbr | get_state(Sigma, im1, jp1);
-  mbr               = mbr | get_state(Sigma, i, jm1);
-  mbr               = mbr | get_state(Sigma, i, jp1);
-  mbr               = mbr | static_cast<uint8_t>(get_state(Sigma, ip1, jm1) * causal_cond);
-  mbr               = mbr | static_cast<uint8_t>(get_state(Sigma, ip1, j) * causal_cond);
-  mbr               = mbr | static_cast<uint8_t>(get_state(Sigma, ip1, jp1) * causal_cond);
-
-  mbr = mbr | static_cast<uint8_t>(get_state(Refinement_value, im1, jm1) * get_state(Scan, im1, jm1));
-  mbr = mbr | static_cast<uint8_t>(get_state(Refinement_value, im1, j) * get_state(Scan, im1, j));
-  mbr = mbr | static_cast<uint8_t>(get_state(Refinement_value, im1, jp1) * get_state(Scan, im1, jp1));
-  mbr = mbr | static_cast<uint8_t>(get_state(Refinement_value, i, jm1) * get_state(Scan, i, jm1));
-  mbr = mbr | static_cast<uint8_t>(get_state(Refinement_value, i, jp1) * get_state(Scan, i, jp1));
-  mbr = mbr
-        | static_cast<uint8_t>(get_state(Refinement_value, ip1, jm1) * get_state(Scan, ip1, jm1)
-                               * causal_cond);
-  mbr = mbr
-        | static_cast<uint8_t>(get_state(Refinement_value, ip1, j) * get_state(Scan, ip1, j) * causal_cond);
-  mbr = mbr
-        | static_cast<uint8_t>(get_state(Refinement_value, ip1, jp1) * get_state(Scan, ip1, jp1)
-                               * causal_cond);
+  // a neighbour counts if it is significant, or if it became significant in
+  // this SigProp pass (refinement value and scan bits both set); the three
+  // rows of neighbours are read straight from block_states
+  auto nbr = [](const uint8_t s) {
+    return static_cast<uint8_t>(((s >> SHIFT_SIGMA) | ((s >> SHIFT_REF) & (s >> SHIFT_SCAN))) & 1);
+  };
+  const uint8_t *above = &state(static_cast<int16_t>(i - 1), static_cast<int16_t>(j - 1));
+  const uint8_t *cur   = above + blkstate_stride;
+  const uint8_t *below = cur + blkstate_stride;
+  uint8_t mbr = nbr(above[0]) | nbr(above[1]) | nbr(above[2]) | nbr(cur[0]) | nbr(cur[2]);
+  mbr         = mbr | static_cast<uint8_t>((nbr(below[0]) | nbr(below[1]) | nbr(below[2])) * causal_cond);
   return mbr;
 }
 
+template <class MagSgn_decoder>
 void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t Lcup, const int32_t Pcup,
-                       const int32_t Scup) {
-  fwd_buf<0xFF> MagSgn(block->get_compressed_data(), Pcup);
+                       const int32_t Scup, ht_dec_workspace *work) {
+  MagSgn_decoder MagSgn(block->get_compressed_data(), Pcup);
   MEL_dec MEL(block->get_compressed_data(), Lcup, Scup);
   rev_buf VLC_dec(block->get_compressed_data(), Lcup, Scup);
   const uint16_t QW = static_cast<uint16_t>(ceil_int(static_cast<int16_t>(block->size.x), 2));
   const uint16_t QH = static_cast<uint16_t>(ceil_int(static_cast<int16_t>(block->size.y), 2));
 
   alignas(32) uint32_t m_quads[8];
-  alignas(32) uint32_t msval[8];
   alignas(32) int32_t sigma_quads[8];
   alignas(32) uint32_t mu_quads[8];
   alignas(32) uint32_t v_quads[8];
-  alignas(32) uint32_t known_1[2];
 
   auto mp0 = block->sample_buf.get();
-  auto mp1 = block->sample_buf.get() + block->size.x;
+  auto mp1 = block->sample_buf.get() + block->blksampl_stride;
   auto sp0 = block->block_states.get() + 1 + block->blkstate_stride;
   auto sp1 = block->block_states.get() + 1 + 2 * block->blkstate_stride;
 
@@ -197,12 +180,17 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
   dec_table0 = dec_CxtVLC_table0_fast_16;
   dec_table1 = dec_CxtVLC_table1_fast_16;
 
-  alignas(32) auto rholine = MAKE_UNIQUE<int32_t[]>(QW + 3U);
-  rholine[0]               = 0;
-  auto rho_p               = rholine.get() + 1;
-  alignas(32) auto Eline   = MAKE_UNIQUE<int32_t[]>(2U * QW + 6U);
-  Eline[0]                 = 0;
-  auto E_p                 = Eline.get() + 1;
+  // line buffers come from the caller's workspace and are not cleared: the initial line-pair writes the
+  // first QW entries of rho_p and 2 * QW of E_p, so only the borders around them are zeroed
+  int32_t *const rholine = work->rholine;
+  int32_t *const Eline   = work->Eline;
+  rholine[0]             = 0;
+  rholine[QW + 1]        = 0;
+  rholine[QW + 2]        = 0;
+  Eline[0]               = 0;
+  memset(Eline + 2U * QW + 1U, 0, sizeof(int32_t) * 5U);
+  auto rho_p = rholine + 1;
+  auto E_p   = Eline + 1;
 
   int32_t context = 0;
   uint32_t vlcval;
@@ -293,35 +281,7 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
     }
 
     // recoverMagSgnValue
-    for (uint32_t i = 0; i < 8; i++) {
-      msval[i] = MagSgn.fetch();
-      MagSgn.advance(m_quads[i]);
-    }
-
-    for (uint32_t i = 0; i < 4; i++) {
-      known_1[Q0] = (emb_1_0 >> i) & 1;
-      v_quads[i]  = msval[i] & ((1 << m_quads[i]) - 1);
-      v_quads[i] |= known_1[Q0] << m_quads[i];
-      if (m_quads[i] != 0) {
-        mu_quads[i] = static_cast<uint32_t>((v_quads[i] >> 1) + 1);
-        mu_quads[i] <<= pLSB;
-        mu_quads[i] |= static_cast<uint32_t>((v_quads[i] & 1) << 31);  // sign bit
-      } else {
-        mu_quads[i] = 0;
-      }
-    }
-    for (uint32_t i = 0; i < 4; i++) {
-      known_1[Q1]    = (emb_1_1 >> i) & 1;
-      v_quads[i + 4] = msval[i + 4] & ((1 << m_quads[i + 4]) - 1);
-      v_quads[i + 4] |= known_1[Q1] << m_quads[i + 4];
-      if (m_quads[i + 4] != 0) {
-        mu_quads[i + 4] = static_cast<uint32_t>((v_quads[i + 4] >> 1) + 1);
-        mu_quads[i + 4] <<= pLSB;
-        mu_quads[i + 4] |= static_cast<uint32_t>((v_quads[i + 4] & 1) << 31);  // sign bit
-      } else {
-        mu_quads[i + 4] = 0;
-      }
-    }
+    MagSgn.decode(m_quads, static_cast<uint32_t>(emb_1_0 | (emb_1_1 << 4)), pLSB, mu_quads, v_quads, 2);
     *mp0++ = static_cast<int>(mu_quads[0]);
     *mp0++ = static_cast<int>(mu_quads[2]);
     *mp0++ = static_cast<int>(mu_quads[0 + 4]);
@@ -392,23 +352,7 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
     }
 
     // recoverMagSgnValue
-    for (uint32_t i = 0; i < 4; i++) {
-      msval[i] = MagSgn.fetch();
-      MagSgn.advance(m_quads[i]);
-    }
-
-    for (uint32_t i = 0; i < 4; i++) {
-      known_1[Q0] = (emb_1_0 >> i) & 1;
-      v_quads[i]  = msval[i] & ((1 << m_quads[i]) - 1);
-      v_quads[i] |= known_1[Q0] << m_quads[i];
-      if (m_quads[i] != 0) {
-        mu_quads[i] = static_cast<uint32_t>((v_quads[i] >> 1) + 1);
-        mu_quads[i] <<= pLSB;
-        mu_quads[i] |= static_cast<uint32_t>((v_quads[i] & 1) << 31);  // sign bit
-      } else {
-        mu_quads[i] = 0;
-      }
-    }
+    MagSgn.decode(m_quads, static_cast<uint32_t>(emb_1_0), pLSB, mu_quads, v_quads, 1);
     *mp0++ = static_cast<int>(mu_quads[0]);
     *mp0++ = static_cast<int>(mu_quads[2]);
     *mp1++ = static_cast<int>(mu_quads[1]);
@@ -428,10 +372,10 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
   /*******************************************************************************************************************/
 
   for (uint16_t row = 1; row < QH; row++) {
-    rho_p      = rholine.get() + 1;
-    E_p        = Eline.get() + 1;
-    mp0        = block->sample_buf.get() + (row * 2U) * block->size.x;
-    mp1        = block->sample_buf.get() + (row * 2U + 1U) * block->size.x;
+    rho_p      = rholine + 1;
+    E_p        = Eline + 1;
+    mp0        = block->sample_buf.get() + (row * 2U) * block->blksampl_stride;
+    mp1        = block->sample_buf.get() + (row * 2U + 1U) * block->blksampl_stride;
     sp0        = block->block_states.get() + (row * 2U + 1U) * block->blkstate_stride + 1U;
     sp1        = block->block_states.get() + (row * 2U + 2U) * block->blkstate_stride + 1U;
     int32_t qx = 0;
@@ -530,35 +474,7 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
       }
 
       // recoverMagSgnValue
-      for (uint32_t i = 0; i < 8; i++) {
-        msval[i] = MagSgn.fetch();
-        MagSgn.advance(m_quads[i]);
-      }
-
-      for (uint32_t i = 0; i < 4; i++) {
-        known_1[Q0] = (emb_1_0 >> i) & 1;
-        v_quads[i]  = msval[i] & ((1 << m_quads[i]) - 1);
-        v_quads[i] |= known_1[Q0] << m_quads[i];
-        if (m_quads[i] != 0) {
-          mu_quads[i] = static_cast<uint32_t>((v_quads[i] >> 1) + 1);
-          mu_quads[i] <<= pLSB;
-          mu_quads[i] |= static_cast<uint32_t>((v_quads[i] & 1) << 31);  // sign bit
-        } else {
-          mu_quads[i] = 0;
-        }
-      }
-      for (uint32_t i = 0; i < 4; i++) {
-        known_1[Q1]    = (emb_k_1 >> i) & 1;
-        v_quads[i + 4] = msval[i + 4] & ((1 << m_quads[i + 4]) - 1);
-        v_quads[i + 4] |= known_1[Q1] << m_quads[i + 4];
-        if (m_quads[i + 4] != 0) {
-          mu_quads[i + 4] = static_cast<uint32_t>((v_quads[i + 4] >> 1) + 1);
-          mu_quads[i + 4] <<= pLSB;
-          mu_quads[i + 4] |= static_cast<uint32_t>((v_quads[i + 4] & 1) << 31);  // sign bit
-        } else {
-          mu_quads[i + 4] = 0;
-        }
-      }
+      MagSgn.decode(m_quads, static_cast<uint32_t>(emb_1_0 | (emb_1_1 << 4)), pLSB, mu_quads, v_quads, 2);
       *mp0++ = static_cast<int>(mu_quads[0]);
       *mp0++ = static_cast<int>(mu_quads[2]);
       *mp0++ = static_cast<int>(mu_quads[0 + 4]);
@@ -635,23 +551,7 @@ void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t
       }
 
       // recoverMagSgnValue
-      for (uint32_t i = 0; i < 4; i++) {
-        msval[i] = MagSgn.fetch();
-        MagSgn.advance(m_quads[i]);
-      }
-
-      for (uint32_t i = 0; i < 4; i++) {
-        known_1[Q0] = (emb_1_0 >> i) & 1;
-        v_quads[i]  = msval[i] & ((1 << m_quads[i]) - 1);
-        v_quads[i] |= known_1[Q0] << m_quads[i];
-        if (m_quads[i] != 0) {
-          mu_quads[i] = static_cast<uint32_t>((v_quads[i] >> 1) + 1);
-          mu_quads[i] <<= pLSB;
-          mu_quads[i] |= static_cast<uint32_t>((v_quads[i] & 1) << 31);  // sign bit
-        } else {
-          mu_quads[i] = 0;
-        }
-      }
+      MagSgn.decode(m_quads, static_cast<uint32_t>(emb_1_0), pLSB, mu_quads, v_quads, 1);
       *mp0++ = static_cast<int>(mu_quads[0]);
       *mp0++ = static_cast<int>(mu_quads[2]);
       *mp1++ = static_cast<int>(mu_quads[1]);
@@ -682,24 +582,24 @@ auto process_stripes_block_dec = [](SP_dec &SigProp, j2k_codeblock *block, const
 
   for (int16_t j = (int16_t)j_start; j < block_width; j++) {
     for (int16_t i = (int16_t)i_start; i < block_height; i++) {
-      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->size.x];
+      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->blksampl_stride];
       causal_cond = (((block->Cmodes & CAUSAL) == 0) || (i != block_height - 1));
       mbr         = 0;
-      if (block->get_state(Sigma, i, j) == 0) {
+      if (block->get_state<Sigma>(i, j) == 0) {
         mbr = block->calc_mbr(i, j, causal_cond);
       }
       if (mbr != 0) {
-        block->modify_state(refinement_indicator, 1, i, j);
+        block->modify_state<refinement_indicator>(1, i, j);
         bit = SigProp.importSigPropBit();
-        block->modify_state(refinement_value, bit, i, j);
+        block->modify_state<refinement_value>(bit, i, j);
         *sp |= bit << pLSB;
       }
-      block->modify_state(scan, 1, i, j);
+      block->modify_state<scan>(1, i, j);
     }
   }
   for (int16_t j = (int16_t)j_start; j < block_width; j++) {
     for (int16_t i = (int16_t)i_start; i < block_height; i++) {
-      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->size.x];
+      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->blksampl_stride];
       // decode sign
       if ((*sp & (1 << pLSB)) != 0) {
         *sp = (*sp & 0x7FFFFFFF) | (SigProp.importSigPropBit() << 31);
@@ -757,9 +657,9 @@ void ht_magref_decode(j2k_codeblock *block, uint8_t *HT_magref_segment, uint32_t
   for (int16_t n1 = 0; n1 < num_v_stripe; n1++) {
     for (int16_t j = 0; j < blk_width; j++) {
       for (int16_t i = i_start; i < i_start + height; i++) {
-        sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->size.x];
-        if (block->get_state(Sigma, i, j) != 0) {
-          block->modify_state(refinement_indicator, 1, i, j);
+        sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->blksampl_stride];
+        if (block->get_state<Sigma>(i, j) != 0) {
+          block->modify_state<refinement_indicator>(1, i, j);
           sp[0] |= MagRef.importMagRefBit() << pLSB;
         }
       }
@@ -769,9 +669,9 @@ void ht_magref_decode(j2k_codeblock *block, uint8_t *HT_magref_segment, uint32_t
   height = static_cast<int16_t>(blk_height % 4);
   for (int16_t j = 0; j < blk_width; j++) {
     for (int16_t i = i_start; i < i_start + height; i++) {
-      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->size.x];
-      if (block->get_state(Sigma, i, j) != 0) {
-        block->modify_state(refinement_indicator, 1, i, j);
+      sp = &block->sample_buf[static_cast<size_t>(j) + static_cast<size_t>(i) * block->blksampl_stride];
+      if (block->get_state<Sigma>(i, j) != 0) {
+        block->modify_state<refinement_indicator>(1, i, j);
         sp[0] |= MagRef.importMagRefBit() << pLSB;
       }
     }
@@ -788,99 +688,65 @@ void j2k_codeblock::dequantize(uint8_t S_blk, uint8_t ROIshift) const {
   const uint32_t mask = UINT32_MAX >> (M_b + 1);
   // reconstruction parameter defined in E.1.1.2 of the spec
 
+  // i_samples holds the 32-bit samples of the tile: integers for the lossless path, and floats scaled by
+  // the step size for the lossy one
   float fscale = this->stepsize;
-  fscale *= (1 << FRACBITS);
   if (M_b <= 31) {
-    fscale /= (static_cast<float>(1 << (31 - M_b)));
+    fscale /= (static_cast<float>(1U << (31 - M_b)));
   } else {
-    fscale *= (static_cast<float>(1 << (M_b - 31)));
+    fscale *= (static_cast<float>(1U << (M_b - 31)));
   }
-  constexpr int32_t downshift = 15;
-  fscale *= (float)(1 << 16) * (float)(1 << downshift);
-  const auto scale = (int32_t)(fscale + 0.5);
+
+  // Every sample goes through the same branch-free steps as the eight lanes of dequantize_avx2, so that
+  // the loops below vectorize where there is no dedicated kernel. N_b, the number of decoded magnitude
+  // bit-planes, is S_blk + 1, plus one when the refinement indicator in the state byte is set, or M_b
+  // with ROI.
+  const auto reconstruct = [this, S_blk, ROIshift, mask](const int32_t val, const uint8_t state,
+                                                          const bool lossless) {
+    const uint32_t sign = static_cast<uint32_t>(val) & 0x80000000U;
+    uint32_t mag        = static_cast<uint32_t>(val) & INT32_MAX;
+    // detect background region and upshift it
+    const bool background = ROIshift && (mag & ~mask) == 0;
+    mag                   = background ? mag << ROIshift : mag;
+    // do adjustment of the position indicating 0.5
+    const int32_t N_b = ROIshift ? M_b : S_blk + 1 + ((state >> SHIFT_PI_) & 1);
+    const bool half   = mag != 0 && (!lossless || N_b < M_b);
+    mag |= half ? 0x40000000U >> N_b : 0;
+    // bring sign back, converting sign-magnitude to two's complement form
+    return sign ? -static_cast<int32_t>(mag) : static_cast<int32_t>(mag);
+  };
   if (this->transformation) {
     // lossless path
+    assert(pLSB >= 0);  // assure downshift is not negative
     for (size_t i = 0; i < static_cast<size_t>(this->size.y); i++) {
-      int32_t *val      = this->sample_buf.get() + i * this->size.x;
-      uint32_t *dst      = this->i_samples + i * this->band_stride;
-      uint8_t *blkstate = this->block_states.get() + (i + 1) * this->blkstate_stride + 1;
+      const int32_t *val      = this->sample_buf.get() + i * this->blksampl_stride;
+      uint32_t *dst           = this->i_samples + i * this->band_stride;
+      const uint8_t *blkstate = this->block_states.get() + (i + 1) * this->blkstate_stride + 1;
 
       for (size_t j = 0; j < static_cast<size_t>(this->size.x); j++) {
-        int32_t sign = *val & INT32_MIN;
-        *val &= INT32_MAX;
-        // detect background region and upshift it
-        if (ROIshift && (((uint32_t)*val & ~mask) == 0)) {
-          *val <<= ROIshift;
-        }
-        // do adjustment of the position indicating 0.5
-        int32_t N_b = S_blk + 1 + ((*blkstate >> 2) & 1);
-        if (ROIshift) {
-          N_b = M_b;
-        }
-        if (N_b < M_b && *val) {
-          *val |= 1 << (31 - N_b - 1);
-        }
-        // bring sign back
-        *val |= sign;
-        // convert sign-magnitude to two's complement form
-        if (*val < 0) {
-          *val = -(*val & INT32_MAX);
-        }
-
-        assert(pLSB >= 0);  // assure downshift is not negative
-        *dst = static_cast<int16_t>(*val >> pLSB);
-        val++;
-        dst++;
-        blkstate++;
+        dst[j] = static_cast<uint32_t>(reconstruct(val[j], blkstate[j], true) >> pLSB);
       }
     }
   } else {
     // lossy path
-    [[maybe_unused]] int32_t ROImask = 0;
-    if (ROIshift) {
-      ROImask = static_cast<int32_t>(0xFFFFFFFF);
-    }
-    //    auto vROIshift = vdupq_n_s32(ROImask);
     for (size_t i = 0; i < static_cast<size_t>(this->size.y); i++) {
-      int32_t *val      = this->sample_buf.get() + i * this->size.x;
-      uint32_t *dst      = this->i_samples + i * this->band_stride;
-      uint8_t *blkstate = this->block_states.get() + (i + 1) * this->blkstate_stride + 1;
+      const int32_t *val      = this->sample_buf.get() + i * this->blksampl_stride;
+      float *dst              = reinterpret_cast<float *>(this->i_samples) + i * this->band_stride;
+      const uint8_t *blkstate = this->block_states.get() + (i + 1) * this->blkstate_stride + 1;
 
+      //  dequantization
       for (size_t j = 0; j < static_cast<size_t>(this->size.x); j++) {
-        int32_t sign = *val & INT32_MIN;
-        *val &= INT32_MAX;
-        // detect background region and upshift it
-        if (ROIshift && (((uint32_t)*val & ~mask) == 0)) {
-          *val <<= ROIshift;
-        }
-        // do adjustment of the position indicating 0.5
-        int32_t N_b = S_blk + 1 + ((*blkstate >> 2) & 1);
-        if (ROIshift) {
-          N_b = M_b;
-        }
-        if (*val) {
-          *val |= 1 << (31 - N_b - 1);
-        }
-
-        // to prevent overflow, truncate to int16_t
-        *val = (*val + (1 << 15)) >> 16;
-        //  dequantization
-        *val *= scale;
-        // downshift
-        *dst = (int16_t)((*val + (1 << (downshift - 1))) >> downshift);
-        // convert sign-magnitude to two's complement form
-        if (sign) {
-          *dst = static_cast<int16_t>(-(*dst));
-        }
-        val++;
-        dst++;
-        blkstate++;
+        dst[j] = static_cast<float>(reconstruct(val[j], blkstate[j], false)) * fscale;
       }
     }
   }
 }
 
-void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
+// the MagSgn decoder and the dequantizer are template arguments, so that htj2k_decode and htj2k_decode_avx2
+// share the pass decoding
+template <class MagSgn_decoder, void (j2k_codeblock::*dequantizer)(uint8_t, uint8_t) const>
+static bool htj2k_decode_block(j2k_codeblock *block, uint8_t ROIshift, bool dequant,
+                               ht_dec_workspace *work) {
   // number of placeholder pass
   uint8_t P0 = 0;
   // length of HT Cleanup segment
@@ -907,7 +773,7 @@ void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
   if (block->num_passes < empty_passes) {
     printf("WARNING: number of passes %d exceeds number of empty passes %d", block->num_passes,
            empty_passes);
-    return;
+    return false;
   }
   // number of ht coding pass (Z_blk in the spec)
   const uint8_t num_ht_passes = static_cast<uint8_t>(block->num_passes - empty_passes);
@@ -927,7 +793,7 @@ void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
     Lcup += static_cast<int32_t>(block->pass_length[all_segments[0]]);
     if (Lcup < 2) {
       printf("WARNING: Cleanup pass length must be at least 2 bytes in length.\n");
-      return;
+      return false;
     }
     for (uint32_t i = 1; i < all_segments.size(); i++) {
       Lref += block->pass_length[all_segments[i]];
@@ -943,13 +809,13 @@ void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
     const uint8_t S_blk = static_cast<uint8_t>(P0 + block->num_ZBP + S_skip);
     if (S_blk >= 30) {
       printf("WARNING: Number of skipped mag bitplanes %d is too large.\n", S_blk);
-      return;
+      return false;
     }
     // Suffix length (=MEL + VLC) of HT Cleanup pass
     const int32_t Scup = static_cast<int32_t>((Dcup[Lcup - 1] << 4) + (Dcup[Lcup - 2] & 0x0F));
     if (Scup < 2 || Scup > Lcup || Scup > 4079) {
       printf("WARNING: cleanup pass suffix length %d is invalid.\n", Scup);
-      return;
+      return false;
     }
     // modDcup (shall be done before the creation of state_VLC instance)
     Dcup[Lcup - 1] = 0xFF;
@@ -959,7 +825,7 @@ void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
     //    state_MEL_unPacker MEL_unPacker = state_MEL_unPacker(Dcup, Lcup, Pcup);
     //    state_MEL_decoder MEL_decoder   = state_MEL_decoder(MEL_unPacker);
     //    state_VLC_dec VLC               = state_VLC_dec(Dcup, Lcup, Pcup);
-    ht_cleanup_decode(block, static_cast<uint8_t>(30 - S_blk), Lcup, Pcup, Scup);
+    ht_cleanup_decode<MagSgn_decoder>(block, static_cast<uint8_t>(30 - S_blk), Lcup, Pcup, Scup, work);
     if (num_ht_passes > 1) {
       ht_sigprop_decode(block, Dref, Lref, static_cast<uint8_t>(30 - (S_blk + 1)));
     }
@@ -968,8 +834,22 @@ void htj2k_decode(j2k_codeblock *block, uint8_t ROIshift) {
     }
 
     // dequantization
-    block->dequantize(S_blk, ROIshift);
+    if (dequant) {
+      (block->*dequantizer)(S_blk, ROIshift);
+    }
 
   }  // end
+  return true;
 }
+
+bool htj2k_decode(j2k_codeblock *block, uint8_t ROIshift, bool dequant, ht_dec_workspace *work) {
+  return htj2k_decode_block<MagSgn_dec, &j2k_codeblock::dequantize>(block, ROIshift, dequant, work);
+}
+
+  #ifdef OJPH_ENABLE_INTEL_SIMD
+bool htj2k_decode_avx2(j2k_codeblock *block, uint8_t ROIshift, bool dequant, ht_dec_workspace *work) {
+  return htj2k_decode_block<MagSgn_dec_avx2, &j2k_codeblock::dequantize_avx2>(block, ROIshift, dequant,
+                                                                             work);
+}
+  #endif
 #endif
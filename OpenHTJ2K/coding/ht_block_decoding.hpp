@@ -104,6 +104,53 @@ constexpr uint16_t uvlc_dec_1[256] = {
     0x4804, 0x2402, 0x2c8c, 0x4403, 0x2803, 0x2402, 0x56ad, 0xa42c, 0x680d, 0x2402, 0x4c8d, 0x4403, 0x2803,
     0x2402, 0x36ac, 0x640c, 0x4804, 0x2402, 0x2c8c, 0x4403, 0x2803, 0x2402};
 
+// LUT for MEL decoding, decodes all the MEL codewords in the next 8 bits with one lookup
+//   index (12bits) : [bit 11-8] MEL state k (0 to 12)
+//                    [bit  7-0] next 8 bits of the MEL bitstream, first bit in the MSB
+//
+//   output         : [bit   0-2] number of decoded runs (1 to 7)
+//                  : [bit   3-6] number of consumed bits (1 to 8)
+//                  : [bit  7-10] MEL state k after the last decoded codeword
+//                  : [bit 11-59] runs, 7 bits each and the first in the LSBs, in the format of MEL_dec::runs
+struct MEL_dec_table {
+  uint64_t entry[13 * 256];
+  constexpr MEL_dec_table() : entry() {
+    constexpr int32_t MEL_E[13] = {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 4, 5};
+    for (int32_t k = 0; k < 13; ++k) {
+      for (int32_t i = 0; i < 256; ++i) {
+        int32_t MEL_k    = k;
+        int32_t pos      = 0;  // number of consumed bits
+        int32_t num_runs = 0;
+        uint64_t runs    = 0;
+        // at most 7 runs are stored, leaving room for the other fields
+        while (pos < 8 && num_runs < 7) {
+          int32_t eval = MEL_E[MEL_k];
+          int32_t run  = 0;
+          if ((i >> (7 - pos)) & 1) {
+            // "1" is found, a stretch of zeros not terminating in one
+            run   = ((1 << eval) - 1) << 1;
+            MEL_k = ((MEL_k + 1) < 12) ? MEL_k + 1 : 12;
+            pos += 1;
+          } else {
+            // "0" is found, a stretch of zeros terminating with one
+            if (pos + eval + 1 > 8) {
+              break;  // the codeword does not fit in the 8 bits
+            }
+            run   = ((i >> (7 - pos - eval)) & ((1 << eval) - 1)) * 2 + 1;
+            MEL_k = ((MEL_k - 1) > 0) ? MEL_k - 1 : 0;
+            pos += eval + 1;
+          }
+          runs |= static_cast<uint64_t>(run) << (7 * num_runs);
+          num_runs++;
+        }
+        entry[(k << 8) + i] = static_cast<uint64_t>(num_runs) | (static_cast<uint64_t>(pos) << 3)
+                              | (static_cast<uint64_t>(MEL_k) << 7) | (runs << 11);
+      }
+    }
+  }
+};
+constexpr MEL_dec_table MEL_dec_LUT;
+
 /********************************************************************************
  * MEL_dec:
  *******************************************************************************/
@@ -205,37 +252,26 @@ class MEL_dec {
   }
 
   inline void decode() {
-    constexpr int32_t MEL_E[13] = {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 4, 5};
-    if (bits < 6) {  // if there are less than 6 bits in tmp then read from the MEL bitstream 6 bits that is
-                     // the largest decodable MEL codeword.
+    if (bits < 8) {  // if there are less than 8 bits in tmp then read from the MEL bitstream; 8 bits are
+                     // needed for a MEL_dec_LUT lookup.
       read();
     }
-    // repeat so long that there is enough decodable bits in tmp, and the runs store is not full
-    // (num_runs < 8)
-    while (bits >= 6 && num_runs < 8) {
-      int32_t eval = MEL_E[MEL_k];
-      int32_t run  = 0;
-      // The next bit to decode (stored in MSB)
-      if (tmp & (1ULL << 63)) {
-        // "1" is found
-        run = 1 << eval;
-        run--;                                        // consecutive runs of 0 events - 1
-        MEL_k = ((MEL_k + 1) < 12) ? MEL_k + 1 : 12;  // increment, max is 12
-        tmp <<= 1;                                    // consume one bit from tmp
-        bits--;
-        run <<= 1;  // a stretch of zeros not terminating in one
-      } else {
-        // "0" is found
-        run   = static_cast<int32_t>(tmp >> (63 - eval)) & ((1 << eval) - 1);
-        MEL_k = ((MEL_k - 1) > 0) ? MEL_k - 1 : 0;  // decrement, min is 0
-        tmp <<= eval + 1;                           // consume eval + 1 bits (max is 6)
-        bits -= eval + 1;
-        run = (run << 1) + 1;  // a stretch of zeros terminating with one
+    // repeat so long that there is enough decodable bits in tmp, and the runs store has room for the runs
+    // of the next lookup. A lookup decodes all the codewords in the next 8 bits; a codeword is at most 6
+    // bits, so there is at least one.
+    while (bits >= 8) {
+      uint64_t e = MEL_dec_LUT.entry[(MEL_k << 8) + static_cast<int32_t>(tmp >> 56)];
+      int32_t n  = static_cast<int32_t>(e & 0x7);
+      if (num_runs + n > 8) {
+        break;  // the runs store is full
       }
-      eval = num_runs * 7;                             // 7 bits per run
-      runs &= ~(static_cast<uint64_t>(0x3F) << eval);  // 6 bits are sufficient
-      runs |= (static_cast<uint64_t>(run)) << eval;    // store the value in runs
-      num_runs++;                                      // increment count
+      int32_t len = static_cast<int32_t>(e >> 3) & 0xF;
+      MEL_k       = static_cast<int32_t>(e >> 7) & 0xF;
+      tmp <<= len;  // consume len bits from tmp
+      bits -= len;
+      // runs above num_runs are zero, since runs is only ever shifted down
+      runs |= (e >> 11) << (num_runs * 7);
+      num_runs += n;
     }
   }
 
@@ -458,6 +494,97 @@ class fwd_buf {
     return (uint32_t)Creg;
   }
 };
+
+/********************************************************************************
+ * MagSgn_dec: recovers the magnitudes and signs of the samples of one or two quads
+ *******************************************************************************/
+class MagSgn_dec {
+ private:
+  fwd_buf<0xFF> MagSgn;
+
+ public:
+  MagSgn_dec(const uint8_t *Dcup, int32_t Pcup) : MagSgn(Dcup, Pcup) {}
+
+  // m_quads, mu_quads and v_quads hold four samples per quad, and bit 4 * q + i of emb_1 is the known 1 of
+  // sample i of quad q
+  inline void decode(const uint32_t *m_quads, uint32_t emb_1, uint8_t pLSB, uint32_t *mu_quads,
+                     uint32_t *v_quads, uint32_t num_quads) {
+    for (uint32_t i = 0; i < 4 * num_quads; i++) {
+      const uint32_t msval = MagSgn.fetch();
+      MagSgn.advance(m_quads[i]);
+      v_quads[i] = msval & ((1U << m_quads[i]) - 1U);
+      v_quads[i] |= ((emb_1 >> i) & 1) << m_quads[i];
+      if (m_quads[i] != 0) {
+        mu_quads[i] = static_cast<uint32_t>((v_quads[i] >> 1) + 1);
+        mu_quads[i] <<= pLSB;
+        mu_quads[i] |= static_cast<uint32_t>((v_quads[i] & 1) << 31);  // sign bit
+      } else {
+        mu_quads[i] = 0;
+      }
+    }
+  }
+};
+
+/********************************************************************************
+ * MagSgn_dec_avx2: MagSgn_dec for the AVX2 decoder. The bits of a quad pair are gathered at once from a
+ * window of up to 256 unstuffed bits, which is topped up 32 bits at a time from fwd_buf.
+ *******************************************************************************/
+class MagSgn_dec_avx2 {
+ private:
+  fwd_buf<0xFF> MagSgn;
+  alignas(32) uint64_t window[4];  // least significant word first
+  uint32_t bits;                   // number of valid bits in window
+
+ public:
+  MagSgn_dec_avx2(const uint8_t *Dcup, int32_t Pcup) : MagSgn(Dcup, Pcup), window(), bits(0) {}
+
+  // tops the window up so that it holds more than 224 bits
+  inline void fill() {
+    while (bits <= 224) {
+      const uint64_t t = MagSgn.fetch();
+      MagSgn.advance(32);
+      const uint32_t word = bits >> 6, off = bits & 63;
+      window[word] |= t << off;
+      if (off > 32) {  // word < 3 here, since bits <= 224
+        window[word + 1] |= t >> (64 - off);
+      }
+      bits += 32;
+    }
+  }
+
+  inline void advance(uint32_t n) {
+    const uint32_t q = n >> 6, r = n & 63;
+    for (uint32_t i = 0; i < 4; ++i) {
+      const uint64_t a = i + q < 4 ? window[i + q] : 0;
+      const uint64_t b = i + q + 1 < 4 ? window[i + q + 1] : 0;
+      window[i]        = r ? (a >> r) | (b << (64 - r)) : a;
+    }
+    bits -= n;
+  }
+
+  // same as MagSgn_dec::decode
+  void decode(const uint32_t *m_quads, uint32_t emb_1, uint8_t pLSB, uint32_t *mu_quads, uint32_t *v_quads,
+              uint32_t num_quads);
+};
+
+/********************************************************************************
+ * ht_dec_workspace: line buffers of the HT cleanup decoder; the caller keeps one
+ * per thread and reuses it for every codeblock, so that decoding allocates nothing
+ *******************************************************************************/
+struct ht_dec_workspace {
+  // exponents and significance of the quad row above, for up to 1024 columns
+  alignas(32) int32_t Eline[2 * 512 + 6];
+  alignas(32) int32_t rholine[512 + 3];
+};
 
+template <class MagSgn_decoder>
 void ht_cleanup_decode(j2k_codeblock *block, const uint8_t &pLSB, const int32_t Lcup, const int32_t Pcup,
-                       const int32_t Scup);
+                       const int32_t Scup, ht_dec_workspace *work);
+// decodes the HT cleanup, SigProp and MagRef passes of the block, whose pass_length holds the length of the
+// cleanup segment followed by that of the refinement segment. With dequant, the samples are then
+// dequantized into i_samples; otherwise they are left in sample_buf in sign-magnitude form. work holds the
+// line buffers of the cleanup decoder.
+// Returns false if the codestream is invalid.
+bool htj2k_decode(j2k_codeblock *block, uint8_t ROIshift, bool dequant, ht_dec_workspace *work);
+// htj2k_decode with the AVX2 dequantizer
+bool htj2k_decode_avx2(j2k_codeblock *block, uint8_t ROIshift, bool dequant, ht_dec_workspace *work);
@@ -0,0 +1,187 @@
+// Copyright (c) 2019 - 2021, Osamu Watanabe
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+//    modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "ojph_arch.h"
+#include "coding_units.hpp"
+#include "coding_local.hpp"
+#include "ht_block_decoding.hpp"
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+  #include <immintrin.h>
+
+// j2k_codeblock::dequantize, eight samples at a time. The state bytes of a row are widened to a vector
+// of eight lanes, from which the refinement indicators are taken.
+OJPH_TARGET_AVX2
+void j2k_codeblock::dequantize_avx2(uint8_t S_blk, uint8_t ROIshift) const {
+  // number of decoded magnitude bit‐planes
+  const int32_t pLSB = 31 - M_b;  // indicates binary point;
+
+  // bit mask for ROI detection
+  const uint32_t mask = UINT32_MAX >> (M_b + 1);
+
+  float fscale = this->stepsize;
+  if (M_b <= 31) {
+    fscale /= (static_cast<float>(1U << (31 - M_b)));
+  } else {
+    fscale *= (static_cast<float>(1U << (M_b - 31)));
+  }
+
+  const bool lossless       = this->transformation != 0;
+  const __m256i zero        = _mm256_setzero_si256();
+  const __m256i one         = _mm256_set1_epi32(1);
+  const __m256i sign_mask   = _mm256_set1_epi32(INT32_MIN);
+  const __m256i roi_mask    = _mm256_set1_epi32(static_cast<int32_t>(~mask));
+  const __m128i roi_shift   = _mm_cvtsi32_si128(ROIshift);
+  const __m128i down_shift  = _mm_cvtsi32_si128(pLSB);
+  const __m256i vM_b        = _mm256_set1_epi32(M_b);
+  const __m256i half_bit    = _mm256_set1_epi32(0x40000000);
+  const __m256 scale        = _mm256_set1_ps(fscale);
+  const __m256i lane        = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  // N_b is S_blk + 1, plus one for a refined sample, or M_b with ROI
+  const __m256i N_b_base    = _mm256_set1_epi32(ROIshift ? M_b : S_blk + 1);
+  const __m256i refine_step = ROIshift ? zero : one;
+
+  assert(!lossless || pLSB >= 0);  // assure downshift is not negative
+  for (size_t i = 0; i < static_cast<size_t>(this->size.y); i++) {
+    // rows of sample_buf are padded to a multiple of eight samples, and the state row is followed by
+    // another one, so eight lanes can always be read
+    const int32_t *val      = this->sample_buf.get() + i * this->blksampl_stride;
+    uint32_t *dst           = this->i_samples + i * this->band_stride;
+    const uint8_t *blkstate = this->block_states.get() + (i + 1) * this->blkstate_stride + 1;
+
+    for (size_t j = 0; j < static_cast<size_t>(this->size.x); j += 8) {
+      const __m256i v    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(val + j));
+      const __m256i sign = _mm256_and_si256(v, sign_mask);
+      __m256i mag        = _mm256_andnot_si256(sign_mask, v);
+      if (ROIshift) {
+        // detect background region and upshift it
+        const __m256i background = _mm256_cmpeq_epi32(_mm256_and_si256(mag, roi_mask), zero);
+        mag = _mm256_blendv_epi8(mag, _mm256_sll_epi32(mag, roi_shift), background);
+      }
+      // do adjustment of the position indicating 0.5
+      const __m256i state =
+          _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(blkstate + j)));
+      const __m256i N_b =
+          _mm256_add_epi32(N_b_base, _mm256_and_si256(_mm256_srli_epi32(state, SHIFT_PI_), refine_step));
+      __m256i half = _mm256_andnot_si256(_mm256_cmpeq_epi32(mag, zero), _mm256_srlv_epi32(half_bit, N_b));
+      if (lossless) {
+        half = _mm256_and_si256(half, _mm256_cmpgt_epi32(vM_b, N_b));
+      }
+      mag = _mm256_or_si256(mag, half);
+      // bring sign back, converting sign-magnitude to two's complement form
+      __m256i out = _mm256_sign_epi32(mag, _mm256_or_si256(sign, one));
+      if (lossless) {
+        out = _mm256_sra_epi32(out, down_shift);
+      } else {
+        //  dequantization
+        out = _mm256_castps_si256(_mm256_mul_ps(_mm256_cvtepi32_ps(out), scale));
+      }
+      if (j + 8 <= static_cast<size_t>(this->size.x)) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + j), out);
+      } else {
+        const __m256i tail =
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32_t>(this->size.x - j)), lane);
+        _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + j), tail, out);
+      }
+    }
+  }
+}
+
+// 32 bits of window starting at bit off, for each of the eight lanes; off must be below 256
+OJPH_TARGET_AVX2
+static inline __m256i extract_bits(__m256i window, __m256i off) {
+  const __m256i word  = _mm256_srli_epi32(off, 5);
+  const __m256i shift = _mm256_and_si256(off, _mm256_set1_epi32(31));
+  const __m256i next  = _mm256_add_epi32(word, _mm256_set1_epi32(1));
+  __m256i lo          = _mm256_permutevar8x32_epi32(window, word);
+  __m256i hi          = _mm256_permutevar8x32_epi32(window, next);
+  // the word after the last one is zero
+  hi = _mm256_andnot_si256(_mm256_cmpgt_epi32(next, _mm256_set1_epi32(7)), hi);
+  // a shift of 32 produces zero, as needed when shift is 0
+  lo = _mm256_srlv_epi32(lo, shift);
+  hi = _mm256_sllv_epi32(hi, _mm256_sub_epi32(_mm256_set1_epi32(32), shift));
+  return _mm256_or_si256(lo, hi);
+}
+
+// MagSgn_dec::decode for up to two quads: the bit offsets of the samples are the exclusive prefix sum of
+// m_quads, and mu and v are reconstructed in the lanes
+OJPH_TARGET_AVX2
+void MagSgn_dec_avx2::decode(const uint32_t *m_quads, uint32_t emb_1, uint8_t pLSB, uint32_t *mu_quads,
+                             uint32_t *v_quads, uint32_t num_quads) {
+  const __m256i zero  = _mm256_setzero_si256();
+  const __m256i one   = _mm256_set1_epi32(1);
+  const __m256i lane  = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i upper = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+  // lanes beyond num_quads quads read no bits; m above 32 is only found in invalid codestreams, and is
+  // clamped so that a sample never reads more than 32 bits
+  const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32_t>(4 * num_quads)), lane);
+  const __m256i m_n   = _mm256_and_si256(
+      valid, _mm256_min_epu32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(m_quads)),
+                                _mm256_set1_epi32(32)));
+
+  // inclusive scan of m_n, within each quad first, then the total of the first quad is added to the second
+  __m256i inc_sum = _mm256_add_epi32(m_n, _mm256_slli_si256(m_n, 4));
+  inc_sum         = _mm256_add_epi32(inc_sum, _mm256_slli_si256(inc_sum, 8));
+  const __m256i total0 = _mm256_permutevar8x32_epi32(inc_sum, _mm256_set1_epi32(3));
+  inc_sum              = _mm256_add_epi32(inc_sum, _mm256_and_si256(total0, upper));
+  const __m256i ex_sum = _mm256_sub_epi32(inc_sum, m_n);
+  const auto half_mn   = static_cast<uint32_t>(_mm256_extract_epi32(inc_sum, 3));
+  const auto total_mn  = static_cast<uint32_t>(_mm256_extract_epi32(inc_sum, 7));
+
+  fill();
+  __m256i msval;
+  if (total_mn <= bits) {
+    msval = extract_bits(_mm256_load_si256(reinterpret_cast<const __m256i *>(window)), ex_sum);
+    advance(total_mn);
+  } else {
+    // a quad pair can need up to 256 bits, but the window may hold as few as 225; the first quad is
+    // decoded, the window topped up, and then the second quad is decoded
+    const __m256i first = extract_bits(_mm256_load_si256(reinterpret_cast<const __m256i *>(window)), ex_sum);
+    advance(half_mn);
+    fill();
+    const __m256i off    = _mm256_sub_epi32(ex_sum, _mm256_set1_epi32(static_cast<int32_t>(half_mn)));
+    const __m256i second = extract_bits(_mm256_load_si256(reinterpret_cast<const __m256i *>(window)),
+                                        _mm256_and_si256(off, upper));
+    msval = _mm256_blendv_epi8(first, second, upper);
+    advance(total_mn - half_mn);
+  }
+
+  const __m256i bit = _mm256_sllv_epi32(one, m_n);  // 1 << m_n
+  const __m256i known_1 =
+      _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int32_t>(emb_1)), lane), one);
+  __m256i v = _mm256_and_si256(msval, _mm256_sub_epi32(bit, one));
+  v         = _mm256_or_si256(v, _mm256_sllv_epi32(known_1, m_n));
+  __m256i mu = _mm256_sll_epi32(_mm256_add_epi32(_mm256_srli_epi32(v, 1), one), _mm_cvtsi32_si128(pLSB));
+  mu         = _mm256_or_si256(mu, _mm256_slli_epi32(v, 31));  // sign bit
+  mu         = _mm256_andnot_si256(_mm256_cmpeq_epi32(m_n, zero), mu);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(v_quads), v);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(mu_quads), mu);
+}
+
+#endif
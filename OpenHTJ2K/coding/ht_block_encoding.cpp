@@ -42,11 +42,18 @@
 //#define ENABLE_SP_MR
 
 // Quantize DWT coefficients and transfer them to codeblock buffer in a form of MagSgn value
-void j2k_codeblock::quantize(uint32_t &or_val) const {
+// distortion receives the reduction in squared error of the cleanup pass, in units of the
+// squared quantization step; irreversible samples are taken to lie in the middle of their
+// quantization interval, and are reconstructed at the middle of the cleanup pass interval
+void j2k_codeblock::quantize(uint32_t &or_val, float &distortion) const {
   const uint32_t height = this->size.y;
   const uint32_t stride = this->band_stride;
   const int32_t pshift  = (refsegment) ? 1 : 0;
   const int32_t pLSB    = (1 << (pshift - 1));
+  const bool reversible = transformation == 1;
+  const float x_off     = reversible ? 0.0f : 0.5f;
+  const float r_off     = (reversible && !pshift) ? 0.0f : 0.5f;
+  float dist            = 0.0f;
 
   for (uint16_t i = 0; i < static_cast<uint16_t>(height); ++i) {
     uint32_t *const sp  = this->i_samples + i * stride;
@@ -62,8 +69,11 @@ void j2k_codeblock::quantize(uint32_t &or_val) const {
       dstblk[j] |= static_cast<uint8_t>((sign >> 31) << SHIFT_SSGN);
       temp = (temp < 0) ? -temp : temp;
       temp &= 0x7FFFFFFF;
+      const float x = static_cast<float>(temp) + x_off;
       temp >>= pshift;
       if (temp) {
+        const float r = (static_cast<float>(temp) + r_off) * static_cast<float>(1 << pshift);
+        dist += r * (2.0f * x - r);
         or_val |= 1;
         dstblk[j] |= 1;
         temp--;
@@ -74,6 +84,7 @@ void j2k_codeblock::quantize(uint32_t &or_val) const {
       block_index++;
     }
   }
+  distortion = dist;
 }
 
   /********************************************************************************
@@ -384,7 +395,8 @@ int32_t termSPandMR(SP_enc &SP, MR_enc &MR) {
 /********************************************************************************
  * HT cleanup encoding
  *******************************************************************************/
-int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift) noexcept {
+int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift,
+                             ht_enc_workspace *const work) noexcept {
   // length of HT cleanup pass
   int32_t Lcup;
   // length of MagSgn buffer
@@ -400,7 +412,7 @@ int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift)
   const uint16_t QW = static_cast<uint16_t>(ceil_int(static_cast<int16_t>(block->size.x), 2));
   const uint16_t QH = static_cast<uint16_t>(ceil_int(static_cast<int16_t>(block->size.y), 2));
 
-  block->quantize(or_val);
+  block->quantize(or_val, block->pass_distortion[0]);
 
   if (!or_val) {
     // nothing to do here because this codeblock is empty
@@ -416,23 +428,24 @@ int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift)
     return static_cast<int32_t>(block->length);
   }
 
-  // buffers shall be zeroed.
-  std::unique_ptr<uint8_t[]> fwd_buf = MAKE_UNIQUE<uint8_t[]>(MAX_Lcup);
-  std::unique_ptr<uint8_t[]> rev_buf = MAKE_UNIQUE<uint8_t[]>(MAX_Scup);
-  memset(fwd_buf.get(), 0, sizeof(uint8_t) * (MAX_Lcup));
-  memset(rev_buf.get(), 0, sizeof(uint8_t) * MAX_Scup);
+  // buffers shall be zeroed; they come from the caller's workspace, which is
+  // reused for every codeblock
+  uint8_t *const fwd_buf = work->fwd_buf;
+  uint8_t *const rev_buf = work->rev_buf;
+  memset(fwd_buf, 0, sizeof(uint8_t) * (MAX_Lcup));
+  memset(rev_buf, 0, sizeof(uint8_t) * MAX_Scup);
 
-  state_MS_enc MagSgn_encoder(fwd_buf.get());
-  state_MEL_enc MEL_encoder(rev_buf.get());
-  state_VLC_enc VLC_encoder(rev_buf.get());
+  state_MS_enc MagSgn_encoder(fwd_buf);
+  state_MEL_enc MEL_encoder(rev_buf);
+  state_VLC_enc VLC_encoder(rev_buf);
 
   alignas(32) uint32_t v_n[8];
-  alignas(32) auto Eline         = MAKE_UNIQUE<int32_t[]>(2U * QW + 6U);
-  Eline[0]                       = 0;
-  auto E_p                       = Eline.get() + 1;
-  alignas(32) auto rholine       = MAKE_UNIQUE<int32_t[]>(QW + 3U);
-  rholine[0]                     = 0;
-  auto rho_p                     = rholine.get() + 1;
+  int32_t *const Eline   = work->Eline;
+  int32_t *const rholine = work->rholine;
+  memset(Eline, 0, sizeof(int32_t) * (2U * QW + 6U));
+  memset(rholine, 0, sizeof(int32_t) * (QW + 3U));
+  auto E_p   = Eline + 1;
+  auto rho_p = rholine + 1;
   alignas(32) uint8_t sigma_n[8] = {0}, rho_q[2] = {0}, m_n[8] = {0};
   alignas(32) int32_t E_n[8] = {0}, U_q[2] = {0};
   uint8_t lw, gamma;
@@ -601,8 +614,8 @@ int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift)
   /*******************************************************************************************************************/
   int32_t Emax0, Emax1;
   for (uint16_t qy = 1; qy < QH; qy++) {
-    E_p      = Eline.get() + 1;
-    rho_p    = rholine.get() + 1;
+    E_p      = Eline + 1;
+    rho_p    = rholine + 1;
     rho_q[1] = 0;
 
     Emax0 = find_max(E_p[-1], E_p[0], E_p[1], E_p[2]);
@@ -765,7 +778,7 @@ int32_t htj2k_cleanup_encode(j2k_codeblock *const block, const uint8_t ROIshift)
       (fwd_buf[static_cast<size_t>(Lcup - 2)] & 0xF0) | static_cast<uint8_t>(Scup & 0x0f);
 
   // transfer Dcup[] to block->compressed_data
-  block->set_compressed_data(fwd_buf.get(), static_cast<uint16_t>(Lcup), MAX_Lref);
+  block->set_compressed_data(fwd_buf, static_cast<uint16_t>(Lcup), MAX_Lref);
   // set length of compressed data
   block->length         = static_cast<uint32_t>(Lcup);
   block->pass_length[0] = static_cast<unsigned int>(Lcup);
@@ -796,17 +809,17 @@ auto process_stripes_block_enc = [](SP_enc &SigProp, j2k_codeblock *block, const
                                 + (static_cast<uint32_t>(i + 1)) * (block->size.x + 2)];
       causal_cond = (((block->Cmodes & CAUSAL) == 0) || (i != i_start + height - 1));
       mbr         = 0;
-      if (block->get_state(Sigma, i, j) == 0) {
+      if (block->get_state<Sigma>(i, j) == 0) {
         mbr = block->calc_mbr(i, j, causal_cond);
       }
       // mbr_info >>= 3;
       if (mbr != 0) {
         bit = (*sp >> SHIFT_SMAG) & 1;
         SigProp.emitSPBit(bit);
-        block->modify_state(refinement_indicator, 1, i, j);
-        block->modify_state(refinement_value, bit, i, j);
+        block->modify_state<refinement_indicator>(1, i, j);
+        block->modify_state<refinement_value>(bit, i, j);
       }
-      block->modify_state(scan, 1, i, j);
+      block->modify_state<scan>(1, i, j);
     }
   }
   for (int16_t j = (int16_t)j_start; j < block_width; j++) {
@@ -814,7 +827,7 @@ auto process_stripes_block_enc = [](SP_enc &SigProp, j2k_codeblock *block, const
       sp = &block->block_states[(static_cast<uint32_t>(j + 1))
                                 + (static_cast<uint32_t>(i + 1)) * (block->size.x + 2)];
       // encode sign
-      if (block->get_state(Refinement_value, i, j)) {
+      if (block->get_state<Refinement_value>(i, j)) {
         bit = (*sp >> SHIFT_SSGN) & 1;
         SigProp.emitSPBit(bit);
       }
@@ -872,10 +885,10 @@ void ht_magref_encode(j2k_codeblock *block, MR_enc &MagRef) {
       for (int16_t i = (int16_t)i_start; i < (int16_t)i_start + height; i++) {
         sp = &block->block_states[static_cast<uint32_t>(j + 1)
                                   + static_cast<uint32_t>(i + 1) * (block->size.x + 2)];
-        if (block->get_state(Sigma, i, j) != 0) {
+        if (block->get_state<Sigma>(i, j) != 0) {
           bit = (sp[0] >> SHIFT_SMAG) & 1;
           MagRef.emitMRBit(bit);
-          block->modify_state(refinement_indicator, 1, i, j);
+          block->modify_state<refinement_indicator>(1, i, j);
         }
       }
     }
@@ -886,10 +899,10 @@ void ht_magref_encode(j2k_codeblock *block, MR_enc &MagRef) {
     for (int16_t i = (int16_t)i_start; i < (int16_t)i_start + height; i++) {
       sp = &block->block_states[static_cast<uint32_t>(j + 1)
                                 + static_cast<uint32_t>(i + 1) * (block->size.x + 2)];
-      if (block->get_state(Sigma, i, j) != 0) {
+      if (block->get_state<Sigma>(i, j) != 0) {
         bit = (sp[0] >> SHIFT_SMAG) & 1;
         MagRef.emitMRBit(bit);
-        block->modify_state(refinement_indicator, 1, i, j);
+        block->modify_state<refinement_indicator>(1, i, j);
       }
     }
   }
@@ -898,11 +911,11 @@ void ht_magref_encode(j2k_codeblock *block, MR_enc &MagRef) {
 /********************************************************************************
  * HT encoding
  *******************************************************************************/
-int32_t htj2k_encode(j2k_codeblock *block, uint8_t ROIshift) noexcept {
+int32_t htj2k_encode(j2k_codeblock *block, uint8_t ROIshift, ht_enc_workspace *work) noexcept {
   #ifdef ENABLE_SP_MR
   block->refsegment = true;
   #endif
-  int32_t Lcup = htj2k_cleanup_encode(block, ROIshift);
+  int32_t Lcup = htj2k_cleanup_encode(block, ROIshift, work);
   if (Lcup && block->refsegment) {
     uint8_t Dref[2047] = {0};
     SP_enc SigProp(Dref);
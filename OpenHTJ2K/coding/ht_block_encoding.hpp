@@ -33,6 +33,18 @@
 #define MAX_Scup 4079
 #define MAX_Lref 2046
 
+/********************************************************************************
+ * ht_enc_workspace: buffers of the HT cleanup encoder; the caller keeps one per
+ * thread and reuses it for every codeblock, so that encoding allocates nothing
+ *******************************************************************************/
+struct ht_enc_workspace {
+  alignas(32) uint8_t fwd_buf[MAX_Lcup];  // MagSgn, then the whole cleanup pass
+  alignas(32) uint8_t rev_buf[MAX_Scup];  // MEL forwards and VLC backwards
+  // exponents and significance of the quad row above, for up to 1024 columns
+  alignas(32) int32_t Eline[2 * 512 + 6];
+  alignas(32) int32_t rholine[512 + 3];
+};
+
 /********************************************************************************
  * state_MS_enc: state class for MagSgn encoding
  *******************************************************************************/
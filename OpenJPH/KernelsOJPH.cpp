@@ -0,0 +1,91 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ojph_arch.h"
+#include "ojph_block_decoder.h"
+#include "ojph_block_encoder.h"
+#include "KernelsOJPH.h"
+
+namespace ojph
+{
+static void roi_shift_generic(int32_t* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+							  uint32_t shift)
+{
+	int32_t thresh = 1 << roiShift;
+	for(uint32_t i = 0; i < len; ++i)
+	{
+		int32_t val = src[i];
+		int32_t mag = (val & 0x7FFFFFFF);
+		if(mag >= thresh)
+			val = (int32_t)(((uint32_t)mag >> roiShift) & ((uint32_t)val & 0x80000000));
+		int32_t val_shifted = (val & 0x7FFFFFFF) >> shift;
+		dest[i] = ((uint32_t)val & 0x80000000) ? -val_shifted : val_shifted;
+	}
+}
+static void roi_scale_generic(float* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+							  float scale)
+{
+	int32_t thresh = 1 << roiShift;
+	for(uint32_t i = 0; i < len; ++i)
+	{
+		int32_t val = src[i];
+		int32_t mag = (val & 0x7FFFFFFF);
+		if(mag >= thresh)
+			val = (int32_t)(((uint32_t)mag >> roiShift) & ((uint32_t)val & 0x80000000));
+		float val_scaled = (float)(val & 0x7FFFFFFF) * scale;
+		dest[i] = ((uint32_t)val & 0x80000000) ? -val_scaled : val_scaled;
+	}
+}
+
+static KernelsOJPH selectKernels()
+{
+	KernelsOJPH k;
+	k.decode_codeblock = local::ojph_decode_codeblock;
+	k.decode_codeblock_pair = local::ojph_decode_codeblock_pair;
+	k.encode_codeblock = local::ojph_encode_codeblock_direct;
+	k.rev_to_sign_magnitude = local::ojph_rev_tx_to_cb;
+	k.irv_to_sign_magnitude = local::ojph_irv_tx_to_cb;
+	k.roi_shift = roi_shift_generic;
+	k.roi_scale = roi_scale_generic;
+	k.cpu_ext_level = get_cpu_ext_level();
+#ifdef OJPH_ENABLE_INTEL_SIMD
+	if(k.cpu_ext_level >= X86_CPU_EXT_LEVEL_SSSE3)
+	{
+		k.decode_codeblock = local::ojph_decode_codeblock_ssse3;
+		k.decode_codeblock_pair = local::ojph_decode_codeblock_pair_ssse3;
+		k.rev_to_sign_magnitude = local::ojph_rev_tx_to_cb_ssse3;
+		k.irv_to_sign_magnitude = local::ojph_irv_tx_to_cb_ssse3;
+	}
+	if(k.cpu_ext_level >= X86_CPU_EXT_LEVEL_AVX2)
+	{
+		k.decode_codeblock = local::ojph_decode_codeblock_avx2;
+		k.decode_codeblock_pair = local::ojph_decode_codeblock_pair_avx2;
+		k.encode_codeblock = local::ojph_encode_codeblock_direct_avx2;
+		k.rev_to_sign_magnitude = local::ojph_rev_tx_to_cb_avx2;
+		k.irv_to_sign_magnitude = local::ojph_irv_tx_to_cb_avx2;
+	}
+#endif
+
+	return k;
+}
+const KernelsOJPH& getKernelsOJPH()
+{
+	static const KernelsOJPH kernels = selectKernels();
+	return kernels;
+}
+
+} // namespace ojph
@@ -0,0 +1,70 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "ojph_block_decoder.h"
+#include "ojph_block_encoder.h"
+
+namespace ojph
+{
+/**
+ * Kernels used by the OpenJPH backend, one entry per hot loop. Each entry
+ * holds the fastest implementation supported by the CPU, or by the level
+ * forced through HTJ2K_CPU_EXT_LEVEL; the table is filled once per process.
+ */
+struct KernelsOJPH
+{
+	// HT block decoder: cleanup, SigProp and MagRef passes
+	bool (*decode_codeblock)(uint8_t* coded_data, uint32_t* decoded_data, uint32_t missing_msbs,
+							 uint32_t num_passes, uint32_t lengths1, uint32_t lengths2,
+							 uint32_t width, uint32_t height, uint32_t stride, bool stripe_causal,
+							 const local::decode_output& output, local::decode_scratch* work);
+	// HT block decoder for two independent codeblocks at once
+	void (*decode_codeblock_pair)(const local::decode_job jobs[2], bool results[2]);
+	// HT block encoder: cleanup and, optionally, SigProp and MagRef passes,
+	// written straight into out, which can hold out_size bytes; distortion,
+	// if not null, receives the distortion reduction of each pass; work is the
+	// caller's reusable encoder memory
+	bool (*encode_codeblock)(uint32_t* buf, uint32_t missing_msbs, uint32_t num_passes,
+							 uint32_t width, uint32_t height, uint32_t stride, bool stripe_causal,
+							 uint32_t* lengths, float* distortion, uint8_t* out,
+							 uint32_t out_size, local::encode_scratch* work);
+	// two's complement samples to the encoder's sign-magnitude input, with
+	// the magnitude shifted up by shift (reversible) or multiplied by scale
+	// and rounded (irreversible); src is strided, dest is contiguous. Both
+	// return the OR of the magnitudes.
+	uint32_t (*rev_to_sign_magnitude)(const int32_t* src, uint32_t src_stride, uint32_t* dest,
+									  uint32_t width, uint32_t height, uint32_t shift);
+	uint32_t (*irv_to_sign_magnitude)(const int32_t* src, uint32_t src_stride, uint32_t* dest,
+									  uint32_t width, uint32_t height, float scale);
+	// post-T1 filters with ROI: sign-magnitude to two's complement integers or
+	// floats. Without ROI, the decoder produces the final samples itself.
+	void (*roi_shift)(int32_t* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+					  uint32_t shift);
+	void (*roi_scale)(float* dest, const int32_t* src, uint32_t len, uint32_t roiShift,
+					  float scale);
+
+	// X86_CPU_EXT_LEVEL_* the table was selected for
+	int cpu_ext_level;
+};
+
+const KernelsOJPH& getKernelsOJPH();
+
+} // namespace ojph
@@ -20,26 +20,30 @@
 #include "ojph_block_encoder.h"
 #include "ojph_mem.h"
 #include "T1OJPH.h"
+#include "T1HT.h"
 
 #include "grk_includes.h"
-
-
-/*void memset32(uint32_t *dest, uint32_t val, uint32_t count)
-{
-    while (count--)
-        *dest++ = val;
-}*/
+
+
+/*void memset32(uint32_t *dest, uint32_t val, uint32_t count)
+{
+    while (count--)
+        *dest++ = val;
+}*/
 
 const uint8_t grk_cblk_dec_compressed_data_pad_ht = 8U;
 
 namespace ojph
 {
-T1OJPH::T1OJPH(bool isCompressor, [[maybe_unused]] grk::TileCodingParams* tcp, uint32_t maxCblkW,
-			   uint32_t maxCblkH)
+T1OJPH::T1OJPH(bool isCompressor, [[maybe_unused]] grk::TileCodingParams* tcp, uint32_t maxCblkW,
+			   uint32_t maxCblkH)
 	: coded_data_size(isCompressor ? 0 : (uint32_t)(maxCblkW * maxCblkH * sizeof(int32_t))),
 	  coded_data(isCompressor ? nullptr : new uint8_t[coded_data_size]),
 	  unencoded_data_size(maxCblkW * maxCblkH), unencoded_data(new int32_t[unencoded_data_size]),
-	  allocator(new mem_fixed_allocator), elastic_alloc(new mem_elastic_allocator(1048576))
+	  decode_work(isCompressor ? nullptr : new local::decode_scratch),
+	  encode_work(isCompressor ? new local::encode_scratch : nullptr),
+	  allocator(new mem_fixed_allocator),
+	  kernels(getKernelsOJPH())
 {
 	if(!isCompressor)
 		memset(coded_data, 0, grk_cblk_dec_compressed_data_pad_ht);
@@ -48,137 +52,201 @@ T1OJPH::~T1OJPH()
 {
 	delete[] coded_data;
 	delete[] unencoded_data;
+	delete decode_work;
+	delete encode_work;
 	delete allocator;
-	delete elastic_alloc;
 }
-void T1OJPH::preCompress([[maybe_unused]] grk::CompressBlockExec* block,
-						 [[maybe_unused]] grk::Tile* tile)
+uint32_t T1OJPH::preCompress(grk::CompressBlockExec* block, grk::Tile* tile)
 {
 	auto cblk = block->cblk;
 	uint32_t w = cblk->width();
 	uint32_t h = cblk->height();
 	uint32_t tile_width =
 		(tile->comps + block->compno)->getWindow()->getResWindowBufferHighestStride();
-	auto tileLineAdvance = (int32_t)(tile_width - w);
-	uint32_t cblk_index = 0;
-	int32_t shift = (int32_t)(31U - (block->k_msbs + 1U));
+	uint32_t shift = 31U - (block->k_msbs + 1U);
 
-	// convert to sign-magnitude
+	// convert to sign-magnitude; the irreversible step is applied as a float,
+	// since truncating inv_step_ht to an integer loses most of its precision
+	auto dest = (uint32_t*)unencoded_data;
 	if(block->qmfbid == 1)
-	{
-		auto tiledp = block->tiledp;
-		for(auto j = 0; j < h; ++j)
-		{
-			for(auto i = 0; i < w; ++i)
-			{
-				int32_t temp = *tiledp++;
-				int32_t val = temp >= 0 ? temp : -temp;
-				int32_t sign = (int32_t)((temp >= 0) ? 0 : 0x80000000);
-				int32_t res = sign | (val << shift);
-				unencoded_data[cblk_index] = res;
-				cblk_index++;
-			}
-			tiledp += tileLineAdvance;
-		}
-	}
-	else
-	{
-		auto tiledp = block->tiledp;
-		for(auto j = 0; j < h; ++j)
-		{
-			for(auto i = 0; i < w; ++i)
-			{
-				int32_t t = *tiledp++ * (int32_t)(block->inv_step_ht) * (1 << shift);
-				int32_t val = t >= 0 ? t : -t;
-				int32_t sign = (int32_t)((t >= 0) ? 0 : 0x80000000);
-				int32_t res = sign | val;
-				unencoded_data[cblk_index] = res;
-				cblk_index++;
-			}
-			tiledp += tileLineAdvance;
-		}
-	}
+		return kernels.rev_to_sign_magnitude(block->tiledp, tile_width, dest, w, h, shift);
+
+	float scale = std::ldexp(block->inv_step_ht, (int)shift);
+	return kernels.irv_to_sign_magnitude(block->tiledp, tile_width, dest, w, h, scale);
 }
 bool T1OJPH::compress(grk::CompressBlockExec* block)
 {
-	preCompress(block, block->tile);
+	uint32_t or_val = preCompress(block, block->tile);
 
-	coded_lists* next_coded = nullptr;
 	auto cblk = block->cblk;
 	cblk->numbps = 0;
-	// optimization below was causing errors in compressing
-	// if (maximum >= (uint32_t)1<<(31U - (block->k_msbs + 1U)))
+	cblk->numPassesTotal = 0;
 	uint32_t w = cblk->width();
 	uint32_t h = cblk->height();
 
-	uint32_t pass_length[2] = {0, 0};
-	// Encoder OJPH 0.9.1 works with numpasses 1. Converter doesn't include std::jthread C++20.
-	ojph::local::ojph_encode_codeblock((uint32_t*)unencoded_data, (uint32_t)(block->k_msbs), 1, w, h, w,
-									   pass_length, elastic_alloc, next_coded);
+	// magnitudes sit above bit (30 - k_msbs); anything below it is dropped by
+	// the encoder, so a block without a set bit there has nothing to code
+	uint32_t shift = 30U - block->k_msbs;
+	if((or_val >> shift) == 0)
+		return true;
 
-	cblk->numPassesTotal = 1;
-	cblk->passes[0].len = (uint32_t)pass_length[0];
-	cblk->passes[0].rate = (uint32_t)pass_length[0];
-	cblk->numbps = 1;
+	// irreversible codeblocks get SigProp and MagRef passes for the least
+	// significant bitplane, giving rate control two more truncation points;
+	// the cleanup pass then stops one bitplane higher, so one fewer
+	// missing MSB is signalled through numbps.  Reversible codeblocks keep a
+	// single cleanup pass, since SigProp skips isolated samples and the
+	// three passes together would not be lossless.  Neither do blocks whose
+	// largest magnitude lies in the least significant bitplane: their cleanup
+	// pass would be empty, and one cleanup pass codes that bitplane more cheaply.
+	bool refine = block->qmfbid != 1 && block->k_msbs > 0 && block->k_msbs < 30 &&
+				  (or_val >> (shift + 1)) != 0;
+	uint32_t num_passes = refine ? 3 : 1;
+	uint32_t missing_msbs = refine ? block->k_msbs - 1U : block->k_msbs;
+	uint32_t pass_length[3] = {0, 0, 0};
+	float distortion[3] = {0, 0, 0};
+	// the passes are coded straight into the codeblock's compressed stream,
+	// which Grok sizes at 4 bytes per sample of the nominal codeblock; the
+	// nominal dimensions are powers of two, no smaller than 4 or than the
+	// codeblock's own
 	assert(cblk->paddedCompressedStream);
-	memcpy(cblk->paddedCompressedStream, next_coded->buf, (size_t)pass_length[0]);
+	auto nominal = [](uint32_t len) {
+		uint32_t n = 4;
+		while(n < len)
+			n <<= 1;
+		return n;
+	};
+	uint32_t capacity = nominal(w) * nominal(h) * (uint32_t)sizeof(int32_t);
+	if(!kernels.encode_codeblock((uint32_t*)unencoded_data, missing_msbs, num_passes, w, h, w,
+								 (block->cblk_sty & GRK_CBLKSTY_VSC) != 0, pass_length, distortion,
+								 cblk->paddedCompressedStream, capacity, encode_work))
+		return false;
+	// a codeblock with nothing significant has empty refinement passes
+	while(num_passes > 1 && pass_length[num_passes - 1] == 0)
+		--num_passes;
+
+	// the encoder reports distortion in units of the cleanup bitplane, which
+	// is k_msbs - missing_msbs bitplanes above the quantization step; the
+	// cumulative reduction lets PCRD find the slopes of the truncation points
+	double weight = std::ldexp(t1ht::distortionWeight(block),
+							   2 * (int)(block->k_msbs - missing_msbs));
+	uint32_t rate = 0;
+	double distortiondec = 0;
+	for(uint32_t i = 0; i < num_passes; ++i)
+	{
+		rate += pass_length[i];
+		distortiondec += distortion[i] * weight;
+		cblk->passes[i].len = pass_length[i];
+		cblk->passes[i].rate = rate;
+		cblk->passes[i].distortiondec = distortiondec;
+		cblk->passes[i].term = 0;
+	}
+	// T2 ends a codeword segment at every terminated pass: the cleanup pass
+	// sits alone in the first segment and the SigProp and MagRef passes share
+	// the second one, so the packet header carries a length for each
+	cblk->passes[0].term = 1;
+	cblk->passes[num_passes - 1].term = 1;
+	cblk->numPassesTotal = num_passes;
+	cblk->numbps = refine ? 2 : 1;
 
 	return true;
 }
-bool T1OJPH::decompress(grk::DecompressBlockExec* block)
+local::decode_output T1OJPH::decodeOutput(grk::DecompressBlockExec* block)
 {
-	auto cblk = block->cblk;
-	if(!cblk->area())
-		return true;
-	//uint16_t stride = (uint16_t)cblk->width();
-	if(!cblk->seg_buffers.empty())
+	// without ROI the decoder dequantizes each row as soon as it is final,
+	// and the Shift/Scale filters are left with a plain copy. The least
+	// significant bitplane of the subband sits at bit 31 - bandNumbps,
+	// whichever passes the codeblock was coded with: a reversible codeblock
+	// with SigProp and MagRef passes refines the bitplane below its cleanup
+	// pass
+	local::decode_output output = {local::decode_output::SIGN_MAGNITUDE, 0, 0.0f};
+	if(block->roishift == 0)
 	{
-		size_t total_seg_len = 2 * grk_cblk_dec_compressed_data_pad_ht + cblk->getSegBuffersLen();
-		if(coded_data_size < (uint32_t)total_seg_len)
+		assert(block->bandNumbps <= 31);
+		if(block->qmfbid == 1)
 		{
-			delete[] coded_data;
-			coded_data = new uint8_t[total_seg_len];
-			coded_data_size = (uint32_t)total_seg_len;
-			memset(coded_data, 0, grk_cblk_dec_compressed_data_pad_ht);
+			output.format = local::decode_output::INTEGER;
+			output.shift = 31U - block->bandNumbps;
 		}
-		memset(coded_data + grk_cblk_dec_compressed_data_pad_ht + (uint8_t)cblk->getSegBuffersLen(), 0,
-			   grk_cblk_dec_compressed_data_pad_ht);
-		uint8_t* actual_coded_data = coded_data + grk_cblk_dec_compressed_data_pad_ht;
-		size_t offset = 0;
-		for(auto& b : cblk->seg_buffers)
+		else
 		{
-			memcpy(actual_coded_data + offset, b->buf, b->len);
-			offset += b->len;
+			output.format = local::decode_output::FLOAT;
+			output.scale = block->stepsize / (float)(1u << (31 - block->bandNumbps));
 		}
+	}
 
-		size_t num_passes = 0;
-		for(uint32_t i = 0; i < cblk->getNumSegments(); ++i)
-		{
-			auto sgrk = cblk->getSegment(i);
-			num_passes += (uint8_t)sgrk->numpasses;
-		}
+	return output;
+}
+bool T1OJPH::prepareDecompress(grk::DecompressBlockExec* block, local::decode_job& job)
+{
+	auto cblk = block->cblk;
+	size_t total_seg_len = 2 * grk_cblk_dec_compressed_data_pad_ht + cblk->getSegBuffersLen();
+	if(coded_data_size < (uint32_t)total_seg_len)
+	{
+		delete[] coded_data;
+		coded_data = new uint8_t[total_seg_len];
+		coded_data_size = (uint32_t)total_seg_len;
+		memset(coded_data, 0, grk_cblk_dec_compressed_data_pad_ht);
+	}
+	memset(coded_data + grk_cblk_dec_compressed_data_pad_ht + cblk->getSegBuffersLen(), 0,
+		   grk_cblk_dec_compressed_data_pad_ht);
+	uint8_t* actual_coded_data = coded_data + grk_cblk_dec_compressed_data_pad_ht;
+	size_t offset = 0;
+	for(auto& b : cblk->seg_buffers)
+	{
+		memcpy(actual_coded_data + offset, b->buf, b->len);
+		offset += b->len;
+	}
 
-		bool rc = false;
-		if(num_passes && offset)
-		{
-		    // Decoder OJPH 0.9.1 doesn't work with numpasses 1.
-			rc = ojph::local::ojph_decode_codeblock(
-				actual_coded_data, (uint32_t*)unencoded_data, (uint32_t)(block->k_msbs), (uint32_t)num_passes,
-				(uint32_t)offset, 0, cblk->width(), cblk->height(), cblk->width(), false);
-        }
-		else
-		{
-			memset(unencoded_data, 0, cblk->width() * cblk->height() * sizeof(int32_t));
-		}
-		if(!rc)
-		{
-			grk::GRK_ERROR("Error in HT block coder");
+	t1ht::HTSegments segments;
+	if(!t1ht::getHTSegments(block, segments))
+		return false;
+
+	job = {actual_coded_data,
+		   (uint32_t*)unencoded_data,
+		   (uint32_t)(block->k_msbs),
+		   segments.num_passes,
+		   segments.lengths1,
+		   segments.lengths2,
+		   cblk->width(),
+		   cblk->height(),
+		   cblk->width(),
+		   (block->cblk_sty & GRK_CBLKSTY_VSC) != 0,
+		   decodeOutput(block),
+		   decode_work};
+
+	return true;
+}
+bool T1OJPH::decompressJob(const local::decode_job& job)
+{
+	bool rc = true;
+	if(job.num_passes)
+		rc = kernels.decode_codeblock(job.coded_data, job.decoded_data, job.missing_msbs,
+									  job.num_passes, job.lengths1, job.lengths2, job.width,
+									  job.height, job.stride, job.stripe_causal, job.output,
+									  job.work);
+	else
+		memset(job.decoded_data, 0, job.width * job.height * sizeof(int32_t));
+	if(!rc)
+		grk::GRK_ERROR("Error in HT block coder");
+
+	return rc;
+}
+bool T1OJPH::decompress(grk::DecompressBlockExec* block)
+{
+	auto cblk = block->cblk;
+	if(!cblk->area())
+		return true;
+	if(!cblk->seg_buffers.empty())
+	{
+		local::decode_job job;
+		if(!prepareDecompress(block, job))
+			return false;
+		if(!decompressJob(job))
 			return false;
-		}
 	}
 
 	block->tilec->postProcessHT(unencoded_data, block, cblk->width());
-
+
 	return true;
 }
 } // namespace ojph
@@ -18,11 +18,11 @@
 #pragma once
 #include "T1Interface.h"
 #include "TileProcessor.h"
+#include "KernelsOJPH.h"
 
 namespace ojph
 {
 class mem_fixed_allocator;
-class mem_elastic_allocator;
 
 struct TileCodingParams;
 
@@ -36,15 +36,24 @@ class T1OJPH : public grk::T1Interface
 	bool decompress(grk::DecompressBlockExec* block);
 
   private:
-	void preCompress(grk::CompressBlockExec* block, grk::Tile* tile);
+	// returns the OR of the magnitudes of the converted codeblock samples
+	uint32_t preCompress(grk::CompressBlockExec* block, grk::Tile* tile);
 	bool postProcess(grk::DecompressBlockExec* block);
+	static local::decode_output decodeOutput(grk::DecompressBlockExec* block);
+	bool prepareDecompress(grk::DecompressBlockExec* block, local::decode_job& job);
+	bool decompressJob(const local::decode_job& job);
 
 	uint32_t coded_data_size;
 	uint8_t* coded_data;
 	uint32_t unencoded_data_size;
 	int32_t* unencoded_data;
+	// decoder work memory, reused for every codeblock
+	local::decode_scratch* decode_work;
+	// encoder work memory, reused for every codeblock
+	local::encode_scratch* encode_work;
 
 	mem_fixed_allocator* allocator;
-	mem_elastic_allocator* elastic_alloc;
+
+	const KernelsOJPH& kernels;
 };
 } // namespace ojph
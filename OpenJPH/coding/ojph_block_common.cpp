@@ -35,9 +35,8 @@
 // Date: 13 May 2022
 //***************************************************************************/
 
-#include <cassert>
+#include <array>
 #include <cstddef>
-#include <cstring>
 #include "ojph_block_common.h"
 
 //***************************************************************************/
@@ -48,6 +47,54 @@
 namespace ojph {
   namespace local {
 
+    //************************************************************************/
+    /** @brief An entry of the VLC tables of the standard, table0.h and
+     *         table1.h
+     *
+     *  c_q is the context for a quad, rho is the signficance pattern for a
+     *  quad, u_off indicate if u value is 0 (u_off is 0), or communicated,
+     *  e_k and e_1 are EMB patterns, cwd is the VLC codeword, and cwd_len
+     *  is the VLC codeword length
+     */
+    struct vlc_src_table { int c_q, rho, u_off, e_k, e_1, cwd, cwd_len; };
+
+    /// @brief VLC table for the initial row of quads
+    static constexpr vlc_src_table vlc_src_tbl0[] = {
+    #include "table0.h"
+    };
+
+    /// @brief VLC table for non-initial rows of quads
+    static constexpr vlc_src_table vlc_src_tbl1[] = {
+    #include "table1.h"
+    };
+
+    //************************************************************************/
+    /** @ingroup vlc_decoding_tables_grp
+     *  @brief Builds a VLC decoding table from one of the tables of the
+     *         standard
+     *
+     *  There can be at most 1024 possibilites, not all of them are valid.
+     *  Each entry of the standard fills every index whose context is c_q
+     *  and whose cwd_len LSBs are cwd.
+     *
+     *  @param [in]  src is vlc_src_tbl0 or vlc_src_tbl1
+     */
+    template <size_t N>
+    static constexpr std::array<ui16, 1024>
+    vlc_make_table(const vlc_src_table (&src)[N])
+    {
+      std::array<ui16, 1024> tbl = {};
+      for (size_t j = 0; j < N; ++j)
+      {
+        const vlc_src_table& e = src[j];
+        ui16 val = (ui16)((e.rho << 4) | (e.u_off << 3)
+                          | (e.e_k << 12) | (e.e_1 << 8) | e.cwd_len);
+        for (int msbs = 0; msbs < (1 << (7 - e.cwd_len)); ++msbs)
+          tbl[(e.c_q << 7) + (msbs << e.cwd_len) + e.cwd] = val;
+      }
+      return tbl;
+    }
+
     //************************************************************************/
     /** @defgroup vlc_decoding_tables_grp VLC decoding tables
      *  @{
@@ -66,116 +113,20 @@ namespace ojph {
      */
 
     /// @brief vlc_tbl0 contains decoding information for initial row of quads
-    ui16 vlc_tbl0[1024] = { 0 };
+    constexpr std::array<ui16, 1024> vlc_tbl0 = vlc_make_table(vlc_src_tbl0);
     /// @brief vlc_tbl1 contains decoding information for non-initial row of 
     ///        quads
-    ui16 vlc_tbl1[1024] = { 0 };
-    /// @}
-
-    //************************************************************************/
-    /** @defgroup uvlc_decoding_tables_grp VLC decoding tables
-     *  @{
-     *  UVLC decoding tables used to partiallu decode u values from UVLC     
-     *  codewords.                                                           \n
-     *  The table index is 8 (or 9)  bits and composed of two parts:         \n
-     *  The 6 LSBs carries the head of the VLC to be decoded. Up to 6 bits to 
-     *  be used; these are uvlc prefix code for quad 0 and 1                 \n
-     *  The 2 (or 3) MSBs contain u_off of quad 0 + 2 * o_off quad 1
-     *  + 4 * mel event for initial row of quads when needed                 \n
-     *                                                                       \n
-     *  Each entry contains, starting from the LSB                           \n
-     *  \li \c total prefix length for quads 0 and 1 (3 bits)                \n
-     *  \li \c total suffix length for quads 0 and 1 (4 bits)                \n
-     *  \li \c suffix length for quad 0 (3 bits)                             \n
-     *  \li \c prefix for quad 0 (3 bits)                                    \n
-     *  \li \c prefix for quad 1 (3 bits)                                    \n
-     */
-
-    /// @brief uvlc_tbl0 contains decoding information for initial row of quads
-    ui16 uvlc_tbl0[256+64] = { 0 };
-    /// @brief uvlc_tbl1 contains decoding information for non-initial row of 
-    ///        quads
-    ui16 uvlc_tbl1[256] = { 0 };
+    constexpr std::array<ui16, 1024> vlc_tbl1 = vlc_make_table(vlc_src_tbl1);
     /// @}
 
-    //************************************************************************/
-    /** @ingroup vlc_decoding_tables_grp
-     *  @brief Initializes vlc_tbl0 and vlc_tbl1 tables, from table0.h and
-     *         table1.h
-     */
-    static bool vlc_init_tables()
-    {
-      const bool debug = false; //useful for checking 
-
-      //Data in the table is arranged in this format (taken from the standard)
-      // c_q is the context for a quad
-      // rho is the signficance pattern for a quad
-      // u_off indicate if u value is 0 (u_off is 0), or communicated
-      // e_k, e_1 EMB patterns
-      // cwd VLC codeword
-      // cwd VLC codeword length
-      struct vlc_src_table { int c_q, rho, u_off, e_k, e_1, cwd, cwd_len; };
-      // initial quad rows
-      vlc_src_table tbl0[] = {
-    #include "table0.h"
-      };
-      // number of entries in the table
-      size_t tbl0_size = sizeof(tbl0) / sizeof(vlc_src_table); 
-
-      // nono-initial quad rows
-      vlc_src_table tbl1[] = {
-    #include "table1.h"
-      };
-      // number of entries in the table
-      size_t tbl1_size = sizeof(tbl1) / sizeof(vlc_src_table);
-
-      if (debug) memset(vlc_tbl0, 0, sizeof(vlc_tbl0)); //unnecessary
-
-      // this is to convert table entries into values for decoder look up
-      // There can be at most 1024 possibilites, not all of them are valid.
-      // 
-      for (int i = 0; i < 1024; ++i)
-      {
-        int cwd = i & 0x7F; // from i extract codeword
-        int c_q = i >> 7;   // from i extract context
-        // See if this case exist in the table, if so then set the entry in
-        // vlc_tbl0
-        for (size_t j = 0; j < tbl0_size; ++j) 
-          if (tbl0[j].c_q == c_q) // this is an and operation
-            if (tbl0[j].cwd == (cwd & ((1 << tbl0[j].cwd_len) - 1)))
-            {
-              if (debug) assert(vlc_tbl0[i] == 0);
-              // Put this entry into the table
-              vlc_tbl0[i] = (ui16)((tbl0[j].rho << 4) | (tbl0[j].u_off << 3)
-                | (tbl0[j].e_k << 12) | (tbl0[j].e_1 << 8) | tbl0[j].cwd_len);
-            }
-      }
-
-      if (debug) memset(vlc_tbl1, 0, sizeof(vlc_tbl1)); //unnecessary
-
-      // this the same as above but for non-initial rows
-      for (int i = 0; i < 1024; ++i)
-      {
-        int cwd = i & 0x7F; //7 bits
-        int c_q = i >> 7;
-        for (size_t j = 0; j < tbl1_size; ++j)
-          if (tbl1[j].c_q == c_q) // this is an and operation
-            if (tbl1[j].cwd == (cwd & ((1 << tbl1[j].cwd_len) - 1)))
-            {
-              if (debug) assert(vlc_tbl1[i] == 0);
-              vlc_tbl1[i] = (ui16)((tbl1[j].rho << 4) | (tbl1[j].u_off << 3)
-                | (tbl1[j].e_k << 12) | (tbl1[j].e_1 << 8) | tbl1[j].cwd_len);
-            }
-      }
-
-      return true;
-    }
-
     //************************************************************************/
     /** @ingroup uvlc_decoding_tables_grp
-     *  @brief Initializes uvlc_tbl0 and uvlc_tbl1 tables
+     *  @brief Builds uvlc_tbl0 or uvlc_tbl1
+     *
+     *  @param [in]  initial_row is true for uvlc_tbl0
      */
-    static bool uvlc_init_tables()
+    template <size_t N>
+    static constexpr std::array<ui16, N> uvlc_make_table(bool initial_row)
     {
       // table stores possible decoding three bits from vlc
       // there are 8 entries for xx1, x10, 100, 000, where x means do not
@@ -183,7 +134,7 @@ namespace ojph {
       // 2 bits in the LSB for prefix length 
       // 3 bits for suffix length
       // 3 bits in the MSB for prefix value (u_pfx in Table 3 of ITU T.814)
-      static const ui8 dec[8] = { // the index is the prefix codeword
+      const ui8 dec[8] = { // the index is the prefix codeword
         3 | (5 << 2) | (5 << 5), //000 == 000, prefix codeword "000"
         1 | (0 << 2) | (1 << 5), //001 == xx1, prefix codeword "1"
         2 | (0 << 2) | (2 << 5), //010 == x10, prefix codeword "01"
@@ -194,38 +145,33 @@ namespace ojph {
         1 | (0 << 2) | (1 << 5)  //111 == xx1, prefix codeword "1"
       };
 
-      for (ui32 i = 0; i < 256 + 64; ++i)
+      std::array<ui16, N> tbl = {};
+      for (ui32 i = 0; i < N; ++i)
       { 
         ui32 mode = i >> 6;
         ui32 vlc = i & 0x3F;
 
+        ui32 total_prefix = 0, u0_suffix_len = 0, total_suffix = 0;
+        ui32 u0 = 0, u1 = 0;
         if (mode == 0)      // both u_off are 0
-          uvlc_tbl0[i] = 0;
+          continue;
         else if (mode <= 2) // u_off are either 01 or 10
         {
           ui32 d = dec[vlc & 0x7];   //look at the least significant 3 bits
 
-          ui32 total_prefix = d & 0x3;
-          ui32 total_suffix = (d >> 2) & 0x7;
-          ui32 u0_suffix_len = (mode == 1) ? total_suffix : 0;
-          ui32 u0 = (mode == 1) ? (d >> 5) : 0;
-          ui32 u1 = (mode == 1) ? 0 : (d >> 5);
-
-          uvlc_tbl0[i] = (ui16)(total_prefix | 
-                               (total_suffix << 3) |
-                               (u0_suffix_len << 7) |
-                               (u0 << 10) |
-                               (u1 << 13));
-          
+          total_prefix = d & 0x3;
+          total_suffix = (d >> 2) & 0x7;
+          u0_suffix_len = (mode == 1) ? total_suffix : 0;
+          u0 = (mode == 1) ? (d >> 5) : 0;
+          u1 = (mode == 1) ? 0 : (d >> 5);
         }
-        else if (mode == 3) // both u_off are 1, and MEL event is 0
-        {
+        else // both u_off are 1; mode 4 is for a MEL event of 1 in the
+        {    // initial row
           ui32 d0 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
           vlc >>= d0 & 0x3;          // Consume bits
           ui32 d1 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
 
-          ui32 total_prefix, u0_suffix_len, total_suffix, u0, u1;
-          if ((d0 & 0x3) == 3)
+          if (initial_row && mode == 3 && (d0 & 0x3) == 3)
           {
             total_prefix = (d0 & 0x3) + 1;
             u0_suffix_len = (d0 >> 2) & 0x7;
@@ -240,90 +186,119 @@ namespace ojph {
             total_suffix = u0_suffix_len + ((d1 >> 2) & 0x7);
             u0 = d0 >> 5;
             u1 = d1 >> 5;
+            if (mode == 4) // MEL event is 1
+            {
+              u0 += 2;
+              u1 += 2;
+            }
           }
-
-          uvlc_tbl0[i] = (ui16)(total_prefix | 
-                               (total_suffix << 3) |
-                               (u0_suffix_len << 7) |
-                               (u0 << 10) |
-                               (u1 << 13));
         }
-        else if (mode == 4) // both u_off are 1, and MEL event is 1
-        {
-          ui32 d0 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
-          vlc >>= d0 & 0x3;          // Consume bits
-          ui32 d1 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
-
-          ui32 total_prefix = (d0 & 0x3) + (d1 & 0x3);
-          ui32 u0_suffix_len = (d0 >> 2) & 0x7;
-          ui32 total_suffix = u0_suffix_len + ((d1 >> 2) & 0x7);
-          ui32 u0 = (d0 >> 5) + 2;
-          ui32 u1 = (d1 >> 5) + 2;
 
-          uvlc_tbl0[i] = (ui16)(total_prefix | 
-                               (total_suffix << 3) |
-                               (u0_suffix_len << 7) |
-                               (u0 << 10) |
-                               (u1 << 13));
-        }
+        tbl[i] = (ui16)(total_prefix | 
+                        (total_suffix << 3) |
+                        (u0_suffix_len << 7) |
+                        (u0 << 10) |
+                        (u1 << 13));
       }
+      return tbl;
+    }
 
-      for (ui32 i = 0; i < 256; ++i)
-      {
-        ui32 mode = i >> 6;
-        ui32 vlc = i & 0x3F;
+    //************************************************************************/
+    /** @defgroup uvlc_decoding_tables_grp VLC decoding tables
+     *  @{
+     *  UVLC decoding tables used to partiallu decode u values from UVLC     
+     *  codewords.                                                           \n
+     *  The table index is 8 (or 9)  bits and composed of two parts:         \n
+     *  The 6 LSBs carries the head of the VLC to be decoded. Up to 6 bits to 
+     *  be used; these are uvlc prefix code for quad 0 and 1                 \n
+     *  The 2 (or 3) MSBs contain u_off of quad 0 + 2 * o_off quad 1
+     *  + 4 * mel event for initial row of quads when needed                 \n
+     *                                                                       \n
+     *  Each entry contains, starting from the LSB                           \n
+     *  \li \c total prefix length for quads 0 and 1 (3 bits)                \n
+     *  \li \c total suffix length for quads 0 and 1 (4 bits)                \n
+     *  \li \c suffix length for quad 0 (3 bits)                             \n
+     *  \li \c prefix for quad 0 (3 bits)                                    \n
+     *  \li \c prefix for quad 1 (3 bits)                                    \n
+     */
 
-        if (mode == 0)       // both u_off are 0
-          uvlc_tbl1[i] = 0;
-        else if (mode <= 2)  // u_off are either 01 or 10
-        {
-          ui32 d = dec[vlc & 0x7];   // look at the 3 LSB bits
+    /// @brief uvlc_tbl0 contains decoding information for initial row of quads
+    constexpr std::array<ui16, 256+64> uvlc_tbl0 =
+      uvlc_make_table<256+64>(true);
+    /// @brief uvlc_tbl1 contains decoding information for non-initial row of 
+    ///        quads
+    constexpr std::array<ui16, 256> uvlc_tbl1 = uvlc_make_table<256>(false);
+    /// @}
 
-          ui32 total_prefix = d & 0x3;
-          ui32 total_suffix = (d >> 2) & 0x7;
-          ui32 u0_suffix_len = (mode == 1) ? total_suffix : 0;
-          ui32 u0 = (mode == 1) ? (d >> 5) : 0;
-          ui32 u1 = (mode == 1) ? 0 : (d >> 5);
+    //************************************************************************/
+    /** @ingroup mel_decoding_tables_grp
+     *  @brief Builds mel_tbl
+     */
+    static constexpr std::array<ui64, 13 * 256> mel_make_table()
+    {
+      const int mel_exp[13] = { //MEL exponents
+        0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 4, 5
+      };
 
-          uvlc_tbl1[i] = (ui16)(total_prefix | 
-                               (total_suffix << 3) |
-                               (u0_suffix_len << 7) |
-                               (u0 << 10) |
-                               (u1 << 13));
-        }
-        else if (mode == 3) // both u_off are 1
+      std::array<ui64, 13 * 256> tbl = {};
+      for (int k = 0; k < 13; ++k)
+        for (int i = 0; i < 256; ++i)
         {
-          ui32 d0 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
-          vlc >>= d0 & 0x3;          // Consume bits
-          ui32 d1 = dec[vlc & 0x7];  // LSBs of VLC are prefix codeword
-
-          ui32 total_prefix = (d0 & 0x3) + (d1 & 0x3);
-          ui32 u0_suffix_len = (d0 >> 2) & 0x7;
-          ui32 total_suffix = u0_suffix_len + ((d1 >> 2) & 0x7);
-          ui32 u0 = d0 >> 5;
-          ui32 u1 = d1 >> 5;
-
-          uvlc_tbl1[i] = (ui16)(total_prefix | 
-                               (total_suffix << 3) |
-                               (u0_suffix_len << 7) |
-                               (u0 << 10) |
-                               (u1 << 13));
+          int state = k;     // MEL state
+          int pos = 0;       // number of consumed bits
+          int num_runs = 0;
+          ui64 runs = 0;
+          // decode codewords until one does not fit in the 8 bits; at most
+          // 7 runs are stored, leaving room for the other fields.  A
+          // codeword is at most 6 bits, so there is at least one run
+          while (pos < 8 && num_runs < 7)
+          {
+            int eval = mel_exp[state];
+            int run = 0;
+            if ((i >> (7 - pos)) & 1)
+            { //one is found, a stretch of zeros not terminating in one
+              run = ((1 << eval) - 1) << 1;
+              state = state + 1 < 12 ? state + 1 : 12;
+              pos += 1;
+            }
+            else
+            { //0 is found, a stretch of zeros terminating with one
+              if (pos + eval + 1 > 8)
+                break;
+              run = (i >> (7 - pos - eval)) & ((1 << eval) - 1);
+              run = (run << 1) + 1;
+              state = state - 1 > 0 ? state - 1 : 0;
+              pos += eval + 1;
+            }
+            runs |= (ui64)run << (7 * num_runs);
+            ++num_runs;
+          }
+          tbl[(k << 8) + i] = (ui64)num_runs | ((ui64)pos << 3)
+                            | ((ui64)state << 7) | (runs << 11);
         }
-      }
-      return true;
+      return tbl;
     }
 
     //************************************************************************/
-    /** @ingroup vlc_decoding_tables_grp
-     *  @brief Initializes VLC tables vlc_tbl0 and vlc_tbl1
+    /** @defgroup mel_decoding_tables_grp MEL decoding table
+     *  @{
+     *  MEL decoding table, used to decode all the MEL codewords that fit   
+     *  in the next 8 bits of the MEL bitstream with one lookup.            \n
+     *  The table index is 12 bits: the MEL state k (0 to 12) in the 4 MSBs, 
+     *  and the next 8 bits of the bitstream, first bit in the MSB, in the  
+     *  8 LSBs.                                                              \n
+     *                                                                       \n
+     *  Each entry contains, starting from the LSB                           \n
+     *  \li \c number of decoded runs, 1 to 7 (3 bits)                       \n
+     *  \li \c number of consumed bits, 1 to 8 (4 bits)                      \n
+     *  \li \c MEL state k after the last decoded codeword (4 bits)          \n
+     *  \li \c the runs, 7 bits each, the first in the LSBs, in the format  
+     *          used by mel_decode (49 bits)                                 \n
      */
-    static bool vlc_tables_initialized = vlc_init_tables();
 
-    //************************************************************************/
-    /** @ingroup uvlc_decoding_tables_grp
-     *  @brief Initializes UVLC tables uvlc_tbl0 and uvlc_tbl1
-     */
-    static bool uvlc_tables_initialized = uvlc_init_tables();
+    /// @brief mel_tbl contains decoding information for MEL codewords
+    constexpr std::array<ui64, 13 * 256> mel_tbl = mel_make_table();
+    /// @}
 
   } // !namespace local
 } // !namespace ojph
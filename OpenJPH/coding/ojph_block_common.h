@@ -35,15 +35,19 @@
 // Date: 13 May 2022
 //***************************************************************************/
 
+#include <array>
+
 #include "ojph_defs.h"
 
 namespace ojph{
   namespace local {
     
-    extern ui16 vlc_tbl0[1024];
-    extern ui16 vlc_tbl1[1024];
-    extern ui16 uvlc_tbl0[256+64];
-    extern ui16 uvlc_tbl1[256];
+    // built at compile time, see ojph_block_common.cpp
+    extern const std::array<ui16, 1024> vlc_tbl0;
+    extern const std::array<ui16, 1024> vlc_tbl1;
+    extern const std::array<ui16, 256+64> uvlc_tbl0;
+    extern const std::array<ui16, 256> uvlc_tbl1;
+    extern const std::array<ui64, 13 * 256> mel_tbl;
 
   } // !namespace local
 } // !namespace ojph
@@ -44,6 +44,52 @@
 namespace ojph {
   namespace local {
 
+    //////////////////////////////////////////////////////////////////////////
+    // Selects what the decoders write to decoded_data. SIGN_MAGNITUDE keeps
+    // samples as they are coded; the other formats dequantize each row once
+    // the last coding pass is done with it, while the row is still in cache.
+    struct decode_output
+    {
+      enum : ui32 {
+        SIGN_MAGNITUDE = 0,
+        INTEGER = 1,  // two's complement of the magnitude shifted by shift
+        FLOAT = 2,    // float holding the signed magnitude times scale
+      };
+      ui32 format;
+      ui32 shift;
+      float scale;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Work memory of the decoders, owned by the caller and reused across
+    // codeblocks; a decoder clears only the part a codeblock reads, so it
+    // need not be initialized
+    struct decode_scratch
+    {
+      ui16 scratch[8 * 513];      // quad information, then significance
+      ui32 v_n_scratch[512 + 4];  // v_n of the quad row above
+      ui16 prev_row_sig[256 + 8]; // significance of the stripe above
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // One codeblock for the decoders that take several codeblocks per call;
+    // the fields are the arguments of ojph_decode_codeblock
+    struct decode_job
+    {
+      ui8* coded_data;
+      ui32* decoded_data;
+      ui32 missing_msbs;
+      ui32 num_passes;
+      ui32 lengths1;
+      ui32 lengths2;
+      ui32 width;
+      ui32 height;
+      ui32 stride;
+      bool stripe_causal;
+      decode_output output;
+      decode_scratch* work;
+    };
+
     //////////////////////////////////////////////////////////////////////////
     //decodes the cleanup pass, significance propagation pass,
     // and magnitude refinement pass
@@ -52,19 +98,47 @@ namespace ojph {
     bool
       ojph_decode_codeblock(ui8* coded_data, ui32* decoded_data,
         ui32 missing_msbs, ui32 num_passes, ui32 lengths1, ui32 lengths2,
-        ui32 width, ui32 height, ui32 stride, bool stripe_causal);
+        ui32 width, ui32 height, ui32 stride, bool stripe_causal,
+        const decode_output& output, decode_scratch* work);
 
     // SSSE3-accelerated decoder
     bool
       ojph_decode_codeblock_ssse3(ui8* coded_data, ui32* decoded_data,
         ui32 missing_msbs, ui32 num_passes, ui32 lengths1, ui32 lengths2,
-        ui32 width, ui32 height, ui32 stride, bool stripe_causal);
+        ui32 width, ui32 height, ui32 stride, bool stripe_causal,
+        const decode_output& output, decode_scratch* work);
+
+    // AVX2-accelerated decoder
+    bool
+      ojph_decode_codeblock_avx2(ui8* coded_data, ui32* decoded_data,
+        ui32 missing_msbs, ui32 num_passes, ui32 lengths1, ui32 lengths2,
+        ui32 width, ui32 height, ui32 stride, bool stripe_causal,
+        const decode_output& output, decode_scratch* work);
+
+    //////////////////////////////////////////////////////////////////////////
+    // decode two independent codeblocks, overlapping their serial VLC/MEL
+    // decoding; results[i] is what ojph_decode_codeblock returns for jobs[i]
+
+    // generic decoder
+    void
+      ojph_decode_codeblock_pair(const decode_job jobs[2], bool results[2]);
+
+    // SSSE3-accelerated decoder
+    void
+      ojph_decode_codeblock_pair_ssse3(const decode_job jobs[2],
+        bool results[2]);
+
+    // AVX2-accelerated decoder
+    void
+      ojph_decode_codeblock_pair_avx2(const decode_job jobs[2],
+        bool results[2]);
 
     // WASM SIMD-accelerated decoder
     bool
       ojph_decode_codeblock_wasm(ui8* coded_data, ui32* decoded_data,
         ui32 missing_msbs, ui32 num_passes, ui32 lengths1, ui32 lengths2,
-        ui32 width, ui32 height, ui32 stride, bool stripe_causal);
+        ui32 width, ui32 height, ui32 stride, bool stripe_causal,
+        const decode_output& output, decode_scratch* work);
 
   }
 }
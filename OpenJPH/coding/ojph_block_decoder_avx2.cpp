@@ -0,0 +1,513 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    This source code incorporates work covered by the following license:
+ */
+// This software is released under the 2-Clause BSD license, included
+// below.
+//
+// Copyright (c) 2019, Aous Naman
+// Copyright (c) 2019, Kakadu Software Pty Ltd, Australia
+// Copyright (c) 2019, The University of New South Wales, Australia
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//***************************************************************************/
+// This file is part of the OpenJPH software implementation.
+// File: ojph_block_decoder.cpp
+// Author: Aous Naman
+// Date: 13 May 2022
+//***************************************************************************/
+
+//***************************************************************************/
+/** @file ojph_block_decoder_avx2.cpp
+ *  @brief implements a faster HTJ2K block decoder using AVX2
+ */
+
+#include "ojph_block_decoder_common.h"
+#include "ojph_block_decoder.h"
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+#include <immintrin.h>
+
+namespace ojph {
+  namespace local {
+
+    //************************************************************************/
+    /** @brief MagSgn reader that keeps up to 256 unstuffed bits
+     *
+     *  A quad pair can need up to 248 bits of MagSgn data; this reader
+     *  keeps a 256-bit window, refilled 32 bits at a time from an ordinary
+     *  frwd_struct.  After frwd256_fill, the window holds more than 224
+     *  bits.
+     */
+    struct frwd256_struct {
+      frwd_struct src;  //!<reads and unstuffs the MagSgn bitstream
+      ui64 w[4];        //!<the window, least significant word first
+      ui32 bits;        //!<number of valid bits in the window
+    };
+
+    //************************************************************************/
+    /** @brief Initializes a frwd256_struct for the MagSgn bitstream
+     *
+     *  @param [in]  msp is a pointer to frwd256_struct
+     *  @param [in]  data is a pointer to the start of data
+     *  @param [in]  size is the number of byte in the bitstream
+     */
+    static inline
+    void frwd256_init(frwd256_struct *msp, const ui8* data, int size)
+    {
+      frwd_init<0xFF>(&msp->src, data, size);
+      msp->w[0] = msp->w[1] = msp->w[2] = msp->w[3] = 0;
+      msp->bits = 0;
+    }
+
+    //************************************************************************/
+    /** @brief Tops up the window so that it holds more than 224 bits
+     *
+     *  @param [in]  msp is a pointer to frwd256_struct
+     */
+    static inline
+    void frwd256_fill(frwd256_struct *msp)
+    {
+      while (msp->bits <= 224)
+      {
+        ui64 t = frwd_fetch<0xFF>(&msp->src);
+        frwd_advance(&msp->src, 32);
+        ui32 word = msp->bits >> 6, off = msp->bits & 63;
+        msp->w[word] |= t << off;
+        if (off > 32) // word < 3 here, since bits <= 224
+          msp->w[word + 1] |= t >> (64 - off);
+        msp->bits += 32;
+      }
+    }
+
+    //************************************************************************/
+    /** @brief Consumes num_bits bits from the window
+     *
+     *  @param [in]  msp is a pointer to frwd256_struct
+     *  @param [in]  num_bits is the number of bits to consume
+     */
+    static inline
+    void frwd256_advance(frwd256_struct *msp, ui32 num_bits)
+    {
+      assert(num_bits <= msp->bits);
+      ui32 q = num_bits >> 6, r = num_bits & 63;
+      for (ui32 i = 0; i < 4; ++i)
+      {
+        ui64 a = i + q < 4 ? msp->w[i + q] : 0;
+        ui64 b = i + q + 1 < 4 ? msp->w[i + q + 1] : 0;
+        msp->w[i] = r ? (a >> r) | (b << (64 - r)) : a;
+      }
+      msp->bits -= num_bits;
+    }
+
+    //************************************************************************/
+    /** @brief Extracts 32 bits starting at bit offset off[i] of window,
+     *         for each of the eight 32-bit lanes i
+     *
+     *  @param [in]  window holds the bitstream, LSB first
+     *  @param [in]  off is the bit offset of each lane; must be below 256
+     */
+    OJPH_TARGET_AVX2 static inline
+    __m256i extract_bits(__m256i window, __m256i off)
+    {
+      __m256i word = _mm256_srli_epi32(off, 5);
+      __m256i shift = _mm256_and_si256(off, _mm256_set1_epi32(31));
+      __m256i next = _mm256_add_epi32(word, _mm256_set1_epi32(1));
+      __m256i lo = _mm256_permutevar8x32_epi32(window, word);
+      __m256i hi = _mm256_permutevar8x32_epi32(window, next);
+      // the word after the last one is zero
+      hi = _mm256_andnot_si256(
+        _mm256_cmpgt_epi32(next, _mm256_set1_epi32(7)), hi);
+      // a shift of 32 produces zero, as needed when shift is 0
+      lo = _mm256_srlv_epi32(lo, shift);
+      hi = _mm256_sllv_epi32(hi,
+        _mm256_sub_epi32(_mm256_set1_epi32(32), shift));
+      return _mm256_or_si256(lo, hi);
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn bits of a quad pair
+     *
+     *  Lanes 0 to 3 of the returned vector hold the samples of the first
+     *  quad, and lanes 4 to 7 those of the second, each in quad scan order;
+     *  that is, (x, y), (x, y+1), (x+1, y), and (x+1, y+1).  Insignificant
+     *  samples are 0.
+     *
+     *  @param [in]  magsgn is a pointer to the MagSgn reader
+     *  @param [in]  inf0 is the quad information of the first quad
+     *  @param [in]  inf1 is the quad information of the second quad
+     *  @param [in]  U_q0 is U_q of the first quad, including kappa
+     *  @param [in]  U_q1 is U_q of the second quad, including kappa
+     *  @param [in]  p_shift holds p - 1 in its lowest 64 bits
+     *  @param [out] vn receives v_n for each of the eight samples
+     */
+    OJPH_TARGET_AVX2 static inline
+    __m256i decode_quad_pair(frwd256_struct *magsgn, ui32 inf0, ui32 inf1,
+                             ui32 U_q0, ui32 U_q1, __m128i p_shift,
+                             __m256i &vn)
+    {
+      __m256i w0 = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_set1_epi32((int)inf0)),
+        _mm_set1_epi32((int)inf1), 1);
+      __m256i rho_bits =
+        _mm256_setr_epi32(0x10, 0x20, 0x40, 0x80, 0x10, 0x20, 0x40, 0x80);
+      __m256i insig = _mm256_cmpeq_epi32(_mm256_and_si256(w0, rho_bits),
+                                         _mm256_setzero_si256());
+      __m256i e_1_bits = _mm256_slli_epi32(rho_bits, 4);
+      __m256i e_1 = _mm256_cmpeq_epi32(_mm256_and_si256(w0, e_1_bits),
+                                       e_1_bits);
+      __m256i e_k_bits = _mm256_slli_epi32(rho_bits, 8);
+      __m256i e_k = _mm256_cmpeq_epi32(_mm256_and_si256(w0, e_k_bits),
+                                       e_k_bits);
+
+      // m_n = U_q - e_k for significant samples, 0 otherwise
+      __m256i U_q = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_set1_epi32((int)U_q0)),
+        _mm_set1_epi32((int)U_q1), 1);
+      __m256i m_n = _mm256_andnot_si256(insig, _mm256_add_epi32(U_q, e_k));
+
+      // inclusive scan of m_n, within each 128-bit lane first, then the
+      // total of the first quad is added to the second
+      __m256i inc_sum = _mm256_add_epi32(m_n, _mm256_slli_si256(m_n, 4));
+      inc_sum = _mm256_add_epi32(inc_sum, _mm256_slli_si256(inc_sum, 8));
+      __m256i total0 = _mm256_permutevar8x32_epi32(inc_sum,
+        _mm256_setr_epi32(3, 3, 3, 3, 3, 3, 3, 3));
+      __m256i upper = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+      inc_sum = _mm256_add_epi32(inc_sum, _mm256_and_si256(total0, upper));
+      __m256i ex_sum = _mm256_sub_epi32(inc_sum, m_n);
+
+      // the number of bits used is also found with scalar arithmetic, so
+      // that the reader can advance without waiting for the vector unit
+      ui32 rho = (inf0 >> 4) & 0xF, e_k_sig = rho & (inf0 >> 12);
+      ui32 half_mn = U_q0 * population_count4(rho)
+                   - population_count4(e_k_sig);
+      rho = (inf1 >> 4) & 0xF; e_k_sig = rho & (inf1 >> 12);
+      ui32 total_mn = half_mn + U_q1 * population_count4(rho)
+                    - population_count4(e_k_sig);
+
+      frwd256_fill(magsgn);
+      __m256i ms_vec;
+      __m256i window = _mm256_loadu_si256((__m256i*)magsgn->w);
+      if (total_mn <= magsgn->bits)
+      {
+        frwd256_advance(magsgn, total_mn);
+        ms_vec = extract_bits(window, ex_sum);
+      }
+      else
+      { // up to 248 bits are needed, but the window may have as few as
+        // 225; decode the first quad, refill, and then the second
+        __m256i first = extract_bits(window, ex_sum);
+        frwd256_advance(magsgn, half_mn);
+        frwd256_fill(magsgn);
+        window = _mm256_loadu_si256((__m256i*)magsgn->w);
+        __m256i off =
+          _mm256_sub_epi32(ex_sum, _mm256_set1_epi32((int)half_mn));
+        __m256i second = extract_bits(window, _mm256_and_si256(off, upper));
+        ms_vec = _mm256_blendv_epi8(first, second, upper);
+        frwd256_advance(magsgn, total_mn - half_mn);
+      }
+
+      __m256i one = _mm256_set1_epi32(1);
+      __m256i shift = _mm256_sllv_epi32(one, m_n);      // 1 << m_n
+      __m256i sign = _mm256_slli_epi32(ms_vec, 31);     // get sign bit
+      __m256i v_n = _mm256_and_si256(ms_vec, _mm256_sub_epi32(shift, one));
+      v_n = _mm256_or_si256(v_n, _mm256_and_si256(e_1, shift)); // add e_1
+      v_n = _mm256_or_si256(v_n, one);                 // add center of bin
+      vn = _mm256_andnot_si256(insig, v_n);
+
+      //add 2 to make it 2*\mu+0.5, shift it up to missing MSBs
+      __m256i val = _mm256_add_epi32(v_n, _mm256_set1_epi32(2));
+      val = _mm256_sll_epi32(val, p_shift);
+      val = _mm256_or_si256(val, sign);
+      return _mm256_andnot_si256(insig, val);
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn segment (step 2) of one quad row, two
+     *         quads at a time
+     *
+     *  @param [in]  magsgn is a pointer to the MagSgn reader
+     *  @param [in]  sp points to the quad information of this row
+     *  @param [in]  vp holds v_n of the row above, and receives this row's
+     *  @param [out] dp points to the first decoded sample of this row
+     *  @param [in]  width is the decoded codeblock width
+     *  @param [in]  stride is the decoded codeblock buffer stride
+     *  @param [in]  p_shift holds p - 1 in its lowest 64 bits
+     *  @param [in]  mmsbp2 is the largest acceptable U_q
+     *  @param [in]  initial is true for the first quad row, where u_q
+     *               already includes kappa
+     *  @return false if a U_q larger than mmsbp2 is found
+     */
+    OJPH_TARGET_AVX2 static inline
+    bool decode_magsgn_row(frwd256_struct *magsgn, const ui16 *sp, ui32 *vp,
+                           ui32 *dp, ui32 width, ui32 stride,
+                           __m128i p_shift, ui32 mmsbp2, bool initial)
+    {
+      // gathers the two rows of a quad pair, each in one 128-bit lane
+      const __m256i row_order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+      ui32 prev_v_n = 0;
+      for (ui32 x = 0; x < width; x += 4, sp += 4, vp += 2, dp += 4)
+      {
+        ui32 cols = ojph_min(width - x, 4u); // columns inside codeblock
+        ui32 inf0 = sp[0], inf1 = cols > 2 ? sp[2] : 0;
+        if (cols == 1)
+          inf0 &= ~0xC0u; // right column of quad 0 is outside codeblock
+        else if (cols == 3)
+          inf1 &= ~0xC0u; // right column of quad 1 is outside codeblock
+
+        ui32 U_q0 = sp[1], U_q1 = sp[3];
+        if (!initial)
+        { // kappa depends on the row above only, so both quads of the
+          // pair are found before vp is modified
+          ui32 gamma = inf0 & 0xF0; gamma &= gamma - 0x10; //is gamma_q 1?
+          ui32 emax = vp[0] | vp[1];
+          emax = 31 - count_leading_zeros(emax | 2); // emax - 1
+          U_q0 += gamma ? emax : 1;
+
+          gamma = inf1 & 0xF0; gamma &= gamma - 0x10;
+          emax = vp[1] | vp[2];
+          emax = 31 - count_leading_zeros(emax | 2);
+          U_q1 += gamma ? emax : 1;
+        }
+        if (U_q0 > mmsbp2 || (cols > 2 && U_q1 > mmsbp2))
+          return false;
+
+        __m256i vn = _mm256_setzero_si256(), row = _mm256_setzero_si256();
+        if ((inf0 | inf1) & 0xF0)
+          row = decode_quad_pair(magsgn, inf0, inf1, U_q0, U_q1, p_shift,
+                                 vn);
+
+        row = _mm256_permutevar8x32_epi32(row, row_order);
+        if (cols == 4)
+        {
+          _mm_storeu_si128((__m128i*)dp, _mm256_castsi256_si128(row));
+          _mm_storeu_si128((__m128i*)(dp + stride),
+                           _mm256_extracti128_si256(row, 1));
+        }
+        else
+        {
+          ui32 t[8];
+          _mm256_storeu_si256((__m256i*)t, row);
+          for (ui32 i = 0; i < cols; ++i) {
+            dp[i] = t[i];
+            dp[i + stride] = t[i + 4];
+          }
+        }
+
+        vn = _mm256_permutevar8x32_epi32(vn, row_order);
+        __m128i vn_bottom = _mm256_extracti128_si256(vn, 1);
+        vp[0] = prev_v_n | (ui32)_mm_cvtsi128_si32(vn_bottom);
+        if (cols <= 2) {
+          prev_v_n = cols == 2 ? (ui32)_mm_extract_epi32(vn_bottom, 1) : 0;
+          ++vp;
+          break;
+        }
+        vp[1] = (ui32)_mm_extract_epi32(vn_bottom, 1)
+              | (ui32)_mm_extract_epi32(vn_bottom, 2);
+        prev_v_n = (ui32)_mm_extract_epi32(vn_bottom, 3);
+      }
+      vp[0] = prev_v_n;
+      return true;
+    }
+
+    //************************************************************************/
+    /** @brief Converts decoded sign-magnitude samples, in place, to the
+     *         format selected by output, eight samples at a time
+     *
+     *  @param [in,out] dp points to the first sample
+     *  @param [in]     width is the number of samples per row
+     *  @param [in]     height is the number of rows
+     *  @param [in]     stride is the distance between rows, in samples
+     *  @param [in]     output selects the format
+     */
+    OJPH_TARGET_AVX2 static inline
+    void convert_samples(ui32 *dp, ui32 width, ui32 height, ui32 stride,
+                         const decode_output& output)
+    {
+      if (output.format == decode_output::SIGN_MAGNITUDE)
+        return;
+
+      ui32 vec_width = width & ~7u;
+      const __m256i mag_mask = _mm256_set1_epi32(0x7FFFFFFF);
+      const __m128i shift = _mm_cvtsi32_si128((int)output.shift);
+      const __m256 scale = _mm256_set1_ps(output.scale);
+      for (ui32 y = 0; y < height; ++y, dp += stride)
+      {
+        for (ui32 x = 0; x < vec_width; x += 8)
+        {
+          __m256i val = _mm256_loadu_si256((__m256i*)(dp + x));
+          __m256i mag = _mm256_and_si256(val, mag_mask);
+          __m256i res;
+          if (output.format == decode_output::INTEGER)
+          {
+            __m256i sign = _mm256_srai_epi32(val, 31);
+            mag = _mm256_srl_epi32(mag, shift);
+            res = _mm256_sub_epi32(_mm256_xor_si256(mag, sign), sign);
+          }
+          else
+          {
+            __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(mag), scale);
+            res = _mm256_xor_si256(_mm256_castps_si256(f),
+                                   _mm256_andnot_si256(mag_mask, val));
+          }
+          _mm256_storeu_si256((__m256i*)(dp + x), res);
+        }
+        if (vec_width < width)
+          ojph_convert_samples(dp + vec_width, width - vec_width, 1, stride,
+                               output);
+      }
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn segment of the cleanup pass, followed by
+     *         the siginificance propagation and magnitude refinement passes
+     *
+     *  @param [in]   job is the codeblock, with num_passes already checked
+     *  @param [in]   lcup is the length of MagSgn+MEL+VLC segments
+     *  @param [in]   scup is the length of MEL+VLC segments
+     *  @param [in]   scratch holds the quad information from step 1
+     *  @param [in]   sstr is the scratch stride, in ui16 entries
+     */
+    OJPH_TARGET_AVX2
+    static
+    bool decode_magsgn_and_refine(const decode_job& job, int lcup, int scup,
+                                  ui16* scratch, ui32 sstr)
+    {
+      ui8* coded_data = job.coded_data;
+      ui32* decoded_data = job.decoded_data;
+      ui32 missing_msbs = job.missing_msbs;
+      ui32 num_passes = job.num_passes;
+      ui32 width = job.width, height = job.height, stride = job.stride;
+      const decode_output& output = job.output;
+
+      ui32 p = 30 - missing_msbs; // The least significant bitplane for CUP
+      ui32 mmsbp2 = missing_msbs + 2;
+
+      // step2 we decode magsgn
+      {
+        // v_n of the quad row above; see ojph_block_decoder.cpp
+        ui32 *v_n_scratch = job.work->v_n_scratch;
+
+        frwd256_struct magsgn;
+        frwd256_init(&magsgn, coded_data, lcup - scup);
+
+        __m128i p_shift = _mm_cvtsi32_si128((int)p - 1);
+        for (ui32 y = 0; y < height; y += 2)
+        {
+          ui32 *dp = decoded_data + y * stride;
+          if (!decode_magsgn_row(&magsgn, scratch + (y >> 1) * sstr,
+                                 v_n_scratch, dp, width, stride, p_shift,
+                                 mmsbp2, y == 0))
+            return false;
+          if (num_passes == 1)
+            convert_samples(dp, width, height - y < 2 ? height - y : 2,
+                            stride, output);
+        }
+      }
+
+      if (num_passes > 1)
+      {
+        ojph_decode_sigprop_magref(coded_data, decoded_data, scratch, sstr,
+                                   p, num_passes, job.lengths1, job.lengths2,
+                                   width, height, stride,
+                                   job.stripe_causal,
+                                   job.work->prev_row_sig);
+        convert_samples(decoded_data, width, height, stride, output);
+      }
+      return true;
+    }
+
+    //************************************************************************/
+    /** @brief Decodes one codeblock, processing the cleanup, siginificance
+     *         propagation, and magnitude refinement pass
+     *
+     *  Identical in output to ojph_decode_codeblock; the MagSgn step
+     *  decodes the eight samples of a quad pair at once, finding the bit
+     *  offset of each sample from a prefix sum of m_n.  The VLC/MEL step
+     *  and the SPP/MRP passes are shared with the generic decoder.
+     *
+     *  @param [in]   coded_data is a pointer to bitstream
+     *  @param [in]   decoded_data is a pointer to decoded codeblock data buf.
+     *  @param [in]   missing_msbs is the number of missing MSBs
+     *  @param [in]   num_passes is the number of passes: 1 if CUP only,
+     *                2 for CUP+SPP, and 3 for CUP+SPP+MRP
+     *  @param [in]   lengths1 is the length of cleanup pass
+     *  @param [in]   lengths2 is the length of refinement passes (either SPP
+     *                only or SPP+MRP)
+     *  @param [in]   width is the decoded codeblock width
+     *  @param [in]   height is the decoded codeblock height
+     *  @param [in]   stride is the decoded codeblock buffer stride
+     *  @param [in]   stripe_causal is true for stripe causal mode
+     *  @param [in]   output selects the format of decoded samples
+     *  @param [in]   work is the decoder work memory
+     */
+    OJPH_TARGET_AVX2
+    bool ojph_decode_codeblock_avx2(ui8* coded_data, ui32* decoded_data,
+                                    ui32 missing_msbs, ui32 num_passes,
+                                    ui32 lengths1, ui32 lengths2,
+                                    ui32 width, ui32 height, ui32 stride,
+                                    bool stripe_causal,
+                                    const decode_output& output,
+                                    decode_scratch* work)
+    {
+      decode_job job = { coded_data, decoded_data, missing_msbs, num_passes,
+                         lengths1, lengths2, width, height, stride,
+                         stripe_causal, output, work };
+      return ojph_decode_job<decode_magsgn_and_refine>(job);
+    }
+
+    //************************************************************************/
+    /** @brief Decodes two independent codeblocks, overlapping the VLC and
+     *         MEL decoding of one with that of the other
+     *
+     *  @param [in]   jobs are the codeblocks
+     *  @param [out]  results are what ojph_decode_codeblock_avx2 returns for
+     *                each
+     */
+    OJPH_TARGET_AVX2
+    void ojph_decode_codeblock_pair_avx2(const decode_job jobs[2],
+                                         bool results[2])
+    {
+      ojph_decode_job_pair<decode_magsgn_and_refine>(jobs, results);
+    }
+  }
+}
+
+#endif // OJPH_ENABLE_INTEL_SIMD
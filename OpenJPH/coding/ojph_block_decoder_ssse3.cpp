@@ -0,0 +1,514 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    This source code incorporates work covered by the following license:
+ */
+// This software is released under the 2-Clause BSD license, included
+// below.
+//
+// Copyright (c) 2019, Aous Naman
+// Copyright (c) 2019, Kakadu Software Pty Ltd, Australia
+// Copyright (c) 2019, The University of New South Wales, Australia
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//***************************************************************************/
+// This file is part of the OpenJPH software implementation.
+// File: ojph_block_decoder.cpp
+// Author: Aous Naman
+// Date: 13 May 2022
+//***************************************************************************/
+
+//***************************************************************************/
+/** @file ojph_block_decoder_ssse3.cpp
+ *  @brief implements a faster HTJ2K block decoder using SSSE3
+ */
+
+#include "ojph_block_decoder_common.h"
+#include "ojph_block_decoder.h"
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+#include <immintrin.h>
+
+namespace ojph {
+  namespace local {
+
+    //************************************************************************/
+    /** @brief MagSgn reader that keeps up to 128 unstuffed bits
+     *
+     *  The bits of all four samples of a quad can be longer than the 64
+     *  bits that frwd_struct holds, so this reader keeps a 128-bit window,
+     *  refilled 32 bits at a time from an ordinary frwd_struct.  After
+     *  frwd128_fill, the window holds more than 96 bits.
+     */
+    struct frwd128_struct {
+      frwd_struct src;  //!<reads and unstuffs the MagSgn bitstream
+      ui64 lo;          //!<lower 64 bits of the window
+      ui64 hi;          //!<upper 64 bits of the window
+      ui32 bits;        //!<number of valid bits in the window
+    };
+
+    //************************************************************************/
+    /** @brief Initializes a frwd128_struct for the MagSgn bitstream
+     *
+     *  @param [in]  msp is a pointer to frwd128_struct
+     *  @param [in]  data is a pointer to the start of data
+     *  @param [in]  size is the number of byte in the bitstream
+     */
+    static inline
+    void frwd128_init(frwd128_struct *msp, const ui8* data, int size)
+    {
+      frwd_init<0xFF>(&msp->src, data, size);
+      msp->lo = msp->hi = 0;
+      msp->bits = 0;
+    }
+
+    //************************************************************************/
+    /** @brief Tops up the window so that it holds more than 96 bits
+     *
+     *  @param [in]  msp is a pointer to frwd128_struct
+     */
+    static inline
+    void frwd128_fill(frwd128_struct *msp)
+    {
+      while (msp->bits <= 96)
+      {
+        ui64 t = frwd_fetch<0xFF>(&msp->src);
+        frwd_advance(&msp->src, 32);
+        if (msp->bits < 64) {
+          msp->lo |= t << msp->bits;
+          if (msp->bits > 32)
+            msp->hi |= t >> (64 - msp->bits);
+        }
+        else
+          msp->hi |= t << (msp->bits - 64);
+        msp->bits += 32;
+      }
+    }
+
+    //************************************************************************/
+    /** @brief Consumes num_bits bits from the window
+     *
+     *  @param [in]  msp is a pointer to frwd128_struct
+     *  @param [in]  num_bits is the number of bits to consume
+     */
+    static inline
+    void frwd128_advance(frwd128_struct *msp, ui32 num_bits)
+    {
+      assert(num_bits <= msp->bits);
+      if (num_bits == 0)
+        return;
+      if (num_bits < 64) {
+        msp->lo = (msp->lo >> num_bits) | (msp->hi << (64 - num_bits));
+        msp->hi >>= num_bits;
+      }
+      else {
+        msp->lo = msp->hi >> (num_bits - 64);
+        msp->hi = 0;
+      }
+      msp->bits -= num_bits;
+    }
+
+    //************************************************************************/
+    /** @brief Extracts 32 bits starting at bit offset off[i] of window,
+     *         for each of the four 32-bit lanes i
+     *
+     *  Bytes are gathered with pshufb; the remaining 0 to 7 bit shift is
+     *  applied to the 64-bit pair (d1:d0) in three conditional stages,
+     *  since SSSE3 has no per-lane variable shift.
+     *
+     *  @param [in]  window holds the bitstream, LSB first
+     *  @param [in]  off is the bit offset of each lane; must be below 128
+     */
+    OJPH_TARGET_SSSE3 static inline
+    __m128i extract_bits(__m128i window, __m128i off)
+    {
+      __m128i byte_idx = _mm_srli_epi32(off, 3);
+      __m128i bit_idx = _mm_and_si128(off, _mm_set1_epi32(7));
+
+      // replicate the byte index to all bytes of a lane, then add 0,1,2,3
+      byte_idx = _mm_shuffle_epi8(byte_idx,
+        _mm_set_epi32(0x0C0C0C0C, 0x08080808, 0x04040404, 0x00000000));
+      __m128i idx0 = _mm_add_epi8(byte_idx, _mm_set1_epi32(0x03020100));
+      __m128i idx1 = _mm_add_epi8(idx0, _mm_set1_epi8(4));
+      // indices beyond the window produce zeros
+      __m128i limit = _mm_set1_epi8(15);
+      idx0 = _mm_or_si128(idx0, _mm_cmpgt_epi8(idx0, limit));
+      idx1 = _mm_or_si128(idx1, _mm_cmpgt_epi8(idx1, limit));
+      __m128i d0 = _mm_shuffle_epi8(window, idx0);
+      __m128i d1 = _mm_shuffle_epi8(window, idx1);
+
+      // shift (d1:d0) right by bit_idx, 1, 2, and then 4 bits at a time
+      __m128i m, t;
+      m = _mm_cmpeq_epi32(_mm_and_si128(bit_idx, _mm_set1_epi32(1)),
+                          _mm_set1_epi32(1));
+      t = _mm_or_si128(_mm_srli_epi32(d0, 1), _mm_slli_epi32(d1, 31));
+      d0 = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, d0));
+      t = _mm_srli_epi32(d1, 1);
+      d1 = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, d1));
+
+      m = _mm_cmpeq_epi32(_mm_and_si128(bit_idx, _mm_set1_epi32(2)),
+                          _mm_set1_epi32(2));
+      t = _mm_or_si128(_mm_srli_epi32(d0, 2), _mm_slli_epi32(d1, 30));
+      d0 = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, d0));
+      t = _mm_srli_epi32(d1, 2);
+      d1 = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, d1));
+
+      m = _mm_cmpeq_epi32(_mm_and_si128(bit_idx, _mm_set1_epi32(4)),
+                          _mm_set1_epi32(4));
+      t = _mm_or_si128(_mm_srli_epi32(d0, 4), _mm_slli_epi32(d1, 28));
+      d0 = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, d0));
+
+      return d0;
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn bits of one quad
+     *
+     *  The four samples are produced in the lanes of the returned vector,
+     *  in quad scan order; that is, (x, y), (x, y+1), (x+1, y), and
+     *  (x+1, y+1).  Insignificant samples are 0.
+     *
+     *  @param [in]  magsgn is a pointer to the MagSgn reader
+     *  @param [in]  inf is the quad information (rho, e_1, and e_k)
+     *  @param [in]  U_q is the U_q value for this quad, including kappa
+     *  @param [in]  p_shift holds p - 1 in its lowest 64 bits
+     *  @param [out] vn receives v_n for each of the four samples
+     */
+    OJPH_TARGET_SSSE3 static inline
+    __m128i decode_one_quad(frwd128_struct *magsgn, ui32 inf, ui32 U_q,
+                            __m128i p_shift, __m128i &vn)
+    {
+      __m128i w0 = _mm_set1_epi32((int)inf);
+      __m128i rho_bits = _mm_set_epi32(0x80, 0x40, 0x20, 0x10);
+      __m128i insig = _mm_cmpeq_epi32(_mm_and_si128(w0, rho_bits),
+                                      _mm_setzero_si128());
+      __m128i e_1_bits = _mm_set_epi32(0x800, 0x400, 0x200, 0x100);
+      __m128i e_1 = _mm_cmpeq_epi32(_mm_and_si128(w0, e_1_bits), e_1_bits);
+      __m128i e_k_bits = _mm_set_epi32(0x8000, 0x4000, 0x2000, 0x1000);
+      __m128i e_k = _mm_cmpeq_epi32(_mm_and_si128(w0, e_k_bits), e_k_bits);
+
+      // m_n = U_q - e_k for significant samples, 0 otherwise
+      __m128i m_n = _mm_add_epi32(_mm_set1_epi32((int)U_q), e_k);
+      m_n = _mm_andnot_si128(insig, m_n);
+
+      // the exclusive scan of m_n gives the bit offset of each sample
+      __m128i inc_sum = _mm_add_epi32(m_n, _mm_slli_si128(m_n, 4));
+      inc_sum = _mm_add_epi32(inc_sum, _mm_slli_si128(inc_sum, 8));
+      __m128i ex_sum = _mm_slli_si128(inc_sum, 4);
+
+      // the number of bits used is also found with scalar arithmetic, so
+      // that the reader can advance without waiting for the vector unit
+      ui32 rho = (inf >> 4) & 0xF, e_k_sig = rho & (inf >> 12);
+      ui32 total_mn = U_q * population_count4(rho)
+                    - population_count4(e_k_sig);
+
+      frwd128_fill(magsgn);
+      __m128i ms_vec;
+      __m128i window = _mm_set_epi64x((si64)magsgn->hi, (si64)magsgn->lo);
+      if (total_mn <= magsgn->bits)
+      {
+        frwd128_advance(magsgn, total_mn);
+        ms_vec = extract_bits(window, ex_sum);
+      }
+      else
+      { // up to 124 bits are needed, but the window may have as few as 97;
+        // decode the first two samples, refill, and then the other two
+        ui32 half_mn = U_q * population_count4(rho & 3)
+                     - population_count4(e_k_sig & 3);
+        __m128i first = extract_bits(window, ex_sum);
+        frwd128_advance(magsgn, half_mn);
+        frwd128_fill(magsgn);
+        window = _mm_set_epi64x((si64)magsgn->hi, (si64)magsgn->lo);
+        __m128i off = _mm_sub_epi32(ex_sum, _mm_set1_epi32((int)half_mn));
+        __m128i upper = _mm_set_epi32(-1, -1, 0, 0);
+        __m128i second = extract_bits(window, _mm_and_si128(off, upper));
+        ms_vec = _mm_or_si128(_mm_andnot_si128(upper, first),
+                              _mm_and_si128(upper, second));
+        frwd128_advance(magsgn, total_mn - half_mn);
+      }
+
+      // 1 << m_n, obtained from the exponent of a float; this is exact for
+      // m_n <= 31 (1 << 31 converts to 0x80000000)
+      __m128i shift = _mm_slli_epi32(_mm_add_epi32(m_n, _mm_set1_epi32(127)),
+                                     23);
+      shift = _mm_cvttps_epi32(_mm_castsi128_ps(shift));
+
+      __m128i one = _mm_set1_epi32(1);
+      __m128i sign = _mm_slli_epi32(ms_vec, 31);           // get sign bit
+      __m128i v_n = _mm_and_si128(ms_vec, _mm_sub_epi32(shift, one));
+      v_n = _mm_or_si128(v_n, _mm_and_si128(e_1, shift)); // add EMB e_1
+      v_n = _mm_or_si128(v_n, one);                     // add center of bin
+      vn = _mm_andnot_si128(insig, v_n);
+
+      //add 2 to make it 2*\mu+0.5, shift it up to missing MSBs
+      __m128i val = _mm_add_epi32(v_n, _mm_set1_epi32(2));
+      val = _mm_sll_epi32(val, p_shift);
+      val = _mm_or_si128(val, sign);
+      return _mm_andnot_si128(insig, val);
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn segment (step 2) of one quad row
+     *
+     *  @param [in]  magsgn is a pointer to the MagSgn reader
+     *  @param [in]  sp points to the quad information of this row
+     *  @param [in]  vp holds v_n of the row above, and receives this row's
+     *  @param [out] dp points to the first decoded sample of this row
+     *  @param [in]  width is the decoded codeblock width
+     *  @param [in]  stride is the decoded codeblock buffer stride
+     *  @param [in]  p_shift holds p - 1 in its lowest 64 bits
+     *  @param [in]  mmsbp2 is the largest acceptable U_q
+     *  @param [in]  initial is true for the first quad row, where u_q
+     *               already includes kappa
+     *  @return false if a U_q larger than mmsbp2 is found
+     */
+    OJPH_TARGET_SSSE3 static inline
+    bool decode_magsgn_row(frwd128_struct *magsgn, const ui16 *sp, ui32 *vp,
+                           ui32 *dp, ui32 width, ui32 stride,
+                           __m128i p_shift, ui32 mmsbp2, bool initial)
+    {
+      ui32 prev_v_n = 0;
+      for (ui32 x = 0; x < width; x += 2, sp += 2, ++vp, dp += 2)
+      {
+        ui32 inf = sp[0];
+        ui32 U_q = sp[1];
+        if (x + 1 >= width)
+          inf &= ~0xC0u; // the right column lies outside the codeblock
+        if (!initial)
+        {
+          ui32 gamma = inf & 0xF0; gamma &= gamma - 0x10; //is gamma_q 1?
+          ui32 emax = vp[0] | vp[1];
+          emax = 31 - count_leading_zeros(emax | 2); // emax - 1
+          ui32 kappa = gamma ? emax : 1;
+          U_q += kappa;
+        }
+        if (U_q > mmsbp2)
+          return false;
+
+        __m128i vn = _mm_setzero_si128(), row = _mm_setzero_si128();
+        if (inf & 0xF0)
+          row = decode_one_quad(magsgn, inf, U_q, p_shift, vn);
+
+        ui32 v_n1 = (ui32)_mm_cvtsi128_si32(_mm_shuffle_epi32(vn, 1));
+        vp[0] = prev_v_n | v_n1;
+        if (x + 1 < width)
+        {
+          // lanes become (x, y), (x+1, y), (x, y+1), (x+1, y+1)
+          row = _mm_shuffle_epi32(row, _MM_SHUFFLE(3, 1, 2, 0));
+          _mm_storel_epi64((__m128i*)dp, row);
+          _mm_storel_epi64((__m128i*)(dp + stride), _mm_srli_si128(row, 8));
+          prev_v_n = (ui32)_mm_cvtsi128_si32(_mm_shuffle_epi32(vn, 3));
+        }
+        else
+        {
+          dp[0] = (ui32)_mm_cvtsi128_si32(row);
+          dp[stride] = (ui32)_mm_cvtsi128_si32(_mm_shuffle_epi32(row, 1));
+          prev_v_n = 0;
+          ++vp;
+          break;
+        }
+      }
+      vp[0] = prev_v_n;
+      return true;
+    }
+
+    //************************************************************************/
+    /** @brief Converts decoded sign-magnitude samples, in place, to the
+     *         format selected by output, four samples at a time
+     *
+     *  @param [in,out] dp points to the first sample
+     *  @param [in]     width is the number of samples per row
+     *  @param [in]     height is the number of rows
+     *  @param [in]     stride is the distance between rows, in samples
+     *  @param [in]     output selects the format
+     */
+    OJPH_TARGET_SSSE3 static inline
+    void convert_samples(ui32 *dp, ui32 width, ui32 height, ui32 stride,
+                         const decode_output& output)
+    {
+      if (output.format == decode_output::SIGN_MAGNITUDE)
+        return;
+
+      ui32 vec_width = width & ~3u;
+      const __m128i mag_mask = _mm_set1_epi32(0x7FFFFFFF);
+      const __m128i shift = _mm_cvtsi32_si128((int)output.shift);
+      const __m128 scale = _mm_set1_ps(output.scale);
+      for (ui32 y = 0; y < height; ++y, dp += stride)
+      {
+        for (ui32 x = 0; x < vec_width; x += 4)
+        {
+          __m128i val = _mm_loadu_si128((__m128i*)(dp + x));
+          __m128i mag = _mm_and_si128(val, mag_mask);
+          __m128i res;
+          if (output.format == decode_output::INTEGER)
+          {
+            __m128i sign = _mm_srai_epi32(val, 31);
+            mag = _mm_srl_epi32(mag, shift);
+            res = _mm_sub_epi32(_mm_xor_si128(mag, sign), sign);
+          }
+          else
+          {
+            __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(mag), scale);
+            res = _mm_xor_si128(_mm_castps_si128(f),
+                                _mm_andnot_si128(mag_mask, val));
+          }
+          _mm_storeu_si128((__m128i*)(dp + x), res);
+        }
+        if (vec_width < width)
+          ojph_convert_samples(dp + vec_width, width - vec_width, 1, stride,
+                               output);
+      }
+    }
+
+    //************************************************************************/
+    /** @brief Decodes the MagSgn segment of the cleanup pass, followed by
+     *         the siginificance propagation and magnitude refinement passes
+     *
+     *  @param [in]   job is the codeblock, with num_passes already checked
+     *  @param [in]   lcup is the length of MagSgn+MEL+VLC segments
+     *  @param [in]   scup is the length of MEL+VLC segments
+     *  @param [in]   scratch holds the quad information from step 1
+     *  @param [in]   sstr is the scratch stride, in ui16 entries
+     */
+    OJPH_TARGET_SSSE3
+    static
+    bool decode_magsgn_and_refine(const decode_job& job, int lcup, int scup,
+                                  ui16* scratch, ui32 sstr)
+    {
+      ui8* coded_data = job.coded_data;
+      ui32* decoded_data = job.decoded_data;
+      ui32 missing_msbs = job.missing_msbs;
+      ui32 num_passes = job.num_passes;
+      ui32 width = job.width, height = job.height, stride = job.stride;
+      const decode_output& output = job.output;
+
+      ui32 p = 30 - missing_msbs; // The least significant bitplane for CUP
+      ui32 mmsbp2 = missing_msbs + 2;
+
+      // step2 we decode magsgn
+      {
+        // v_n of the quad row above; see ojph_block_decoder.cpp
+        ui32 *v_n_scratch = job.work->v_n_scratch;
+
+        frwd128_struct magsgn;
+        frwd128_init(&magsgn, coded_data, lcup - scup);
+
+        __m128i p_shift = _mm_cvtsi32_si128((int)p - 1);
+        for (ui32 y = 0; y < height; y += 2)
+        {
+          ui32 *dp = decoded_data + y * stride;
+          if (!decode_magsgn_row(&magsgn, scratch + (y >> 1) * sstr,
+                                 v_n_scratch, dp, width, stride, p_shift,
+                                 mmsbp2, y == 0))
+            return false;
+          if (num_passes == 1)
+            convert_samples(dp, width, height - y < 2 ? height - y : 2,
+                            stride, output);
+        }
+      }
+
+      if (num_passes > 1)
+      {
+        ojph_decode_sigprop_magref(coded_data, decoded_data, scratch, sstr,
+                                   p, num_passes, job.lengths1, job.lengths2,
+                                   width, height, stride,
+                                   job.stripe_causal,
+                                   job.work->prev_row_sig);
+        convert_samples(decoded_data, width, height, stride, output);
+      }
+      return true;
+    }
+
+    //************************************************************************/
+    /** @brief Decodes one codeblock, processing the cleanup, siginificance
+     *         propagation, and magnitude refinement pass
+     *
+     *  Identical in output to ojph_decode_codeblock; the MagSgn step
+     *  decodes all four samples of a quad at once, because the bit offset
+     *  of each sample is found from a prefix sum of m_n rather than by
+     *  consuming the bitstream one sample at a time.  The VLC/MEL step and
+     *  the SPP/MRP passes are shared with the generic decoder.
+     *
+     *  @param [in]   coded_data is a pointer to bitstream
+     *  @param [in]   decoded_data is a pointer to decoded codeblock data buf.
+     *  @param [in]   missing_msbs is the number of missing MSBs
+     *  @param [in]   num_passes is the number of passes: 1 if CUP only,
+     *                2 for CUP+SPP, and 3 for CUP+SPP+MRP
+     *  @param [in]   lengths1 is the length of cleanup pass
+     *  @param [in]   lengths2 is the length of refinement passes (either SPP
+     *                only or SPP+MRP)
+     *  @param [in]   width is the decoded codeblock width
+     *  @param [in]   height is the decoded codeblock height
+     *  @param [in]   stride is the decoded codeblock buffer stride
+     *  @param [in]   stripe_causal is true for stripe causal mode
+     *  @param [in]   output selects the format of decoded samples
+     *  @param [in]   work is the decoder work memory
+     */
+    OJPH_TARGET_SSSE3
+    bool ojph_decode_codeblock_ssse3(ui8* coded_data, ui32* decoded_data,
+                                     ui32 missing_msbs, ui32 num_passes,
+                                     ui32 lengths1, ui32 lengths2,
+                                     ui32 width, ui32 height, ui32 stride,
+                                     bool stripe_causal,
+                                     const decode_output& output,
+                                     decode_scratch* work)
+    {
+      decode_job job = { coded_data, decoded_data, missing_msbs, num_passes,
+                         lengths1, lengths2, width, height, stride,
+                         stripe_causal, output, work };
+      return ojph_decode_job<decode_magsgn_and_refine>(job);
+    }
+
+    //************************************************************************/
+    /** @brief Decodes two independent codeblocks, overlapping the VLC and
+     *         MEL decoding of one with that of the other
+     *
+     *  @param [in]   jobs are the codeblocks
+     *  @param [out]  results are what ojph_decode_codeblock_ssse3 returns for
+     *                each
+     */
+    OJPH_TARGET_SSSE3
+    void ojph_decode_codeblock_pair_ssse3(const decode_job jobs[2],
+                                          bool results[2])
+    {
+      ojph_decode_job_pair<decode_magsgn_and_refine>(jobs, results);
+    }
+  }
+}
+
+#endif // OJPH_ENABLE_INTEL_SIMD
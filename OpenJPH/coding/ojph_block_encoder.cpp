@@ -44,6 +44,7 @@
 #include <cstring>
 #include <cstdint>
 #include <climits>
+#include <array>
 #include "grok.h"
 #include "logger.h"
 
@@ -58,167 +59,105 @@ namespace ojph {
     // tables
     /////////////////////////////////////////////////////////////////////////
 
-    //VLC encoding
-    // index is (c_q << 8) + (rho << 4) + eps
-    // data is  (cwd << 8) + (cwd_len << 4) + eps
-    // table 0 is for the initial line of quads
-    static ui16 vlc_tbl0[2048] = { 0 };
-    static ui16 vlc_tbl1[2048] = { 0 };
-
-    //UVLC encoding
-    static int ulvc_cwd_pre[33];
-    static int ulvc_cwd_pre_len[33];
-    static int ulvc_cwd_suf[33];
-    static int ulvc_cwd_suf_len[33];
+    // an entry of the VLC tables of the standard
+    struct vlc_src_table { int c_q, rho, u_off, e_k, e_1, cwd, cwd_len; };
+    static constexpr vlc_src_table vlc_src_tbl0[] = {
+    #include "table0.h"
+    };
+    static constexpr vlc_src_table vlc_src_tbl1[] = {
+    #include "table1.h"
+    };
 
     /////////////////////////////////////////////////////////////////////////
-    static bool vlc_init_tables()
+    // Builds a VLC encoding table.  An index with emb = 0 takes the first
+    // entry of the standard with u_off = 0; an index with emb != 0 takes,
+    // among the entries with u_off = 1 that can code emb, the last one with
+    // the highest number of bits set in e_k.  Indices that cannot occur,
+    // where emb is not a subset of rho, or rho and c_q are both 0, are 0.
+    // Runs over the entries of the standard rather than searching them for
+    // each index, so that it is cheap to evaluate at compile time.
+    template <size_t N>
+    static constexpr std::array<ui16, 2048>
+    vlc_make_table(const vlc_src_table (&src)[N])
     {
-      struct vlc_src_table { int c_q, rho, u_off, e_k, e_1, cwd, cwd_len; };
-      vlc_src_table tbl0[] = {
-    #include "table0.h"
-      };
-      size_t tbl0_size = sizeof(tbl0) / sizeof(vlc_src_table);
-
-      si32 pattern_popcnt[16];
-      for (ui32 i = 0; i < 16; ++i)
-        pattern_popcnt[i] = (si32)population_count(i);
-
-      vlc_src_table* src_tbl = tbl0;
-      ui16 *tgt_tbl = vlc_tbl0;
-      size_t tbl_size = tbl0_size;
-      for (int i = 0; i < 2048; ++i)
+      std::array<ui16, 2048> tbl = {};
+      std::array<int, 2048> best_e_k = {}; // 1 + ones in e_k of the entry
+      for (size_t j = 0; j < N; ++j)
       {
-        int c_q = i >> 8, rho = (i >> 4) & 0xF, emb = i & 0xF;
-        if (((emb & rho) != emb) || (rho == 0 && c_q == 0))
-          tgt_tbl[i] = 0;
-        else
+        const vlc_src_table& e = src[j];
+        if (e.rho == 0 && e.c_q == 0)
+          continue;
+        int base = (e.c_q << 8) + (e.rho << 4);
+        ui16 val = (ui16)((e.cwd << 8) + (e.cwd_len << 4) + e.e_k);
+        if (e.u_off == 0)
         {
-          vlc_src_table *best_entry = NULL;
-          if (emb) // u_off = 1
+          if (best_e_k[base] == 0)
           {
-            int best_e_k = -1;
-            for (size_t j = 0; j < tbl_size; ++j)
-            {
-              if (src_tbl[j].c_q == c_q && src_tbl[j].rho == rho)
-                if (src_tbl[j].u_off == 1)
-                  if ((emb & src_tbl[j].e_k) == src_tbl[j].e_1)
-                  {
-                    //now we need to find the smallest cwd with the highest
-                    // number of bits set in e_k
-                    int ones_count = pattern_popcnt[src_tbl[j].e_k];
-                    if (ones_count >= best_e_k)
-                    {
-                      best_entry = src_tbl + j;
-                      best_e_k = ones_count;
-                    }
-                  }
-            }
+            tbl[base] = val;
+            best_e_k[base] = 1;
           }
-          else // u_off = 0
-          {
-            for (size_t j = 0; j < tbl_size; ++j)
-            {
-              if (src_tbl[j].c_q == c_q && src_tbl[j].rho == rho)
-                if (src_tbl[j].u_off == 0)
-                {
-                  best_entry = src_tbl + j;
-                  break;
-                }
-            }
-          }
-          assert(best_entry);
-          tgt_tbl[i] = (ui16)((best_entry->cwd<<8) + (best_entry->cwd_len<<4)
-                             + best_entry->e_k);
         }
-      }
-
-      vlc_src_table tbl1[] = {
-    #include "table1.h"
-      };
-      size_t tbl1_size = sizeof(tbl1) / sizeof(vlc_src_table);
-
-      src_tbl = tbl1;
-      tgt_tbl = vlc_tbl1;
-      tbl_size = tbl1_size;
-      for (int i = 0; i < 2048; ++i)
-      {
-        int c_q = i >> 8, rho = (i >> 4) & 0xF, emb = i & 0xF;
-        if (((emb & rho) != emb) || (rho == 0 && c_q == 0))
-          tgt_tbl[i] = 0;
         else
         {
-          vlc_src_table *best_entry = NULL;
-          if (emb) // u_off = 1
-          {
-            int best_e_k = -1;
-            for (size_t j = 0; j < tbl_size; ++j)
+          int ones_count = 1;
+          for (int t = e.e_k; t; t &= t - 1)
+            ++ones_count;
+          for (int emb = 1; emb < 16; ++emb)
+            if ((emb & e.rho) == emb && (emb & e.e_k) == e.e_1
+                && ones_count >= best_e_k[base + emb])
             {
-              if (src_tbl[j].c_q == c_q && src_tbl[j].rho == rho)
-                if (src_tbl[j].u_off == 1)
-                  if ((emb & src_tbl[j].e_k) == src_tbl[j].e_1)
-                  {
-                    //now we need to find the smallest cwd with the highest
-                    // number of bits set in e_k
-                    int ones_count = pattern_popcnt[src_tbl[j].e_k];
-                    if (ones_count >= best_e_k)
-                    {
-                      best_entry = src_tbl + j;
-                      best_e_k = ones_count;
-                    }
-                  }
+              tbl[base + emb] = val;
+              best_e_k[base + emb] = ones_count;
             }
-          }
-          else // u_off = 0
-          {
-            for (size_t j = 0; j < tbl_size; ++j)
-            {
-              if (src_tbl[j].c_q == c_q && src_tbl[j].rho == rho)
-                if (src_tbl[j].u_off == 0)
-                {
-                  best_entry = src_tbl + j;
-                  break;
-                }
-            }
-          }
-          assert(best_entry);
-          tgt_tbl[i] = (ui16)((best_entry->cwd<<8) + (best_entry->cwd_len<<4)
-                             + best_entry->e_k);
         }
       }
+      return tbl;
+    }
+
+    //VLC encoding
+    // index is (c_q << 8) + (rho << 4) + eps
+    // data is  (cwd << 8) + (cwd_len << 4) + eps
+    // table 0 is for the initial line of quads
+    static constexpr std::array<ui16, 2048> vlc_tbl0 =
+      vlc_make_table(vlc_src_tbl0);
+    static constexpr std::array<ui16, 2048> vlc_tbl1 =
+      vlc_make_table(vlc_src_tbl1);
 
+    //UVLC encoding
+    //code goes from 0 to 31, extension and 32 are not supported here
+    static constexpr int ulvc_cwd_pre[33] = {
+      0, 1, 2, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    static constexpr int ulvc_cwd_pre_len[33] = {
+      0, 1, 2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+      3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3
+    };
+    static constexpr int ulvc_cwd_suf[33] = {
+      0, 0, 0, 0, 1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+      12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27
+    };
+    static constexpr int ulvc_cwd_suf_len[33] = {
+      0, 0, 0, 1, 1, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+      5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5
+    };
 
-      return true;
-    }
+    //////////////////////////////////////////////////////////////////////////
+    // The three writers below gather codewords in a 64-bit register and
+    // write 4 bytes at a time.  Bit stuffing can only change those bytes if
+    // one of them is 0xFF (MEL and MagSgn) or ends in 7 set bits (VLC), so
+    // one check on the word picks between the plain 4-byte write and a
+    // byte-by-byte path that applies the stuffing rules
+    //////////////////////////////////////////////////////////////////////////
 
-    /////////////////////////////////////////////////////////////////////////
-    static bool uvlc_init_tables()
+    //////////////////////////////////////////////////////////////////////////
+    // true if any byte of w is 0xFF
+    static inline bool has_ff_byte(ui32 w)
     {
-      //code goes from 0 to 31, extension and 32 are not supported here
-      ulvc_cwd_pre[0] = 0; ulvc_cwd_pre[1] = 1; ulvc_cwd_pre[2] = 2;
-      ulvc_cwd_pre[3] = 4; ulvc_cwd_pre[4] = 4;
-      ulvc_cwd_pre_len[0] = 0; ulvc_cwd_pre_len[1] = 1;
-      ulvc_cwd_pre_len[2] = 2;
-      ulvc_cwd_pre_len[3] = 3; ulvc_cwd_pre_len[4] = 3;
-      ulvc_cwd_suf[0] = 0; ulvc_cwd_suf[1] = 0; ulvc_cwd_suf[2] = 0;
-      ulvc_cwd_suf[3] = 0; ulvc_cwd_suf[4] = 1;
-      ulvc_cwd_suf_len[0] = 0; ulvc_cwd_suf_len[1] = 0;
-      ulvc_cwd_suf_len[2] = 0;
-      ulvc_cwd_suf_len[3] = 1; ulvc_cwd_suf_len[4] = 1;
-      for (int i = 5; i < 33; ++i)
-      {
-        ulvc_cwd_pre[i] = 0;
-        ulvc_cwd_pre_len[i] = 3;
-        ulvc_cwd_suf[i] = i-5;
-        ulvc_cwd_suf_len[i] = 5;
-      }
-      return true;
+      ui32 t = ~w;
+      return ((t - 0x01010101u) & ~t & 0x80808080u) != 0;
     }
 
-    /////////////////////////////////////////////////////////////////////////
-    static bool vlc_tables_initialized = vlc_init_tables();
-    static bool uvlc_tables_initialized = uvlc_init_tables();
-
     /////////////////////////////////////////////////////////////////////////
     //
     /////////////////////////////////////////////////////////////////////////
@@ -228,9 +167,9 @@ namespace ojph {
       ui32 pos;      //position of next writing within buf
       ui32 buf_size; //size of buffer, which we must not exceed
 
-      // all these can be replaced by bytes
-      int remaining_bits; //number of empty bits in tmp
-      int tmp;            //temporary storage of coded bits
+      ui64 tmp;      //coded bits not yet written, the latest in the LSB
+      int used_bits; //number of coded bits in tmp
+      bool last_ff;  //true if the last byte written is 0xFF
       int run;            //number of 0 run
       int k;              //state
       int threshold;      //threshold where one bit must be coded
@@ -243,29 +182,55 @@ namespace ojph {
       melp->buf = data;
       melp->pos = 0;
       melp->buf_size = buffer_size;
-      melp->remaining_bits = 8;
       melp->tmp = 0;
+      melp->used_bits = 0;
+      melp->last_ff = false;
       melp->run = 0;
       melp->k = 0;
       melp->threshold = 1; // this is 1 << mel_exp[melp->k];
     }
 
     //////////////////////////////////////////////////////////////////////////
+    // writes the next byte, which holds 7 bits after a 0xFF and 8 otherwise
     static inline void
-    mel_emit_bit(mel_struct* melp, int v)
+    mel_emit_byte(mel_struct* melp)
     {
-      assert(v == 0 || v == 1);
-      melp->tmp = (melp->tmp << 1) + v;
-      melp->remaining_bits--;
-      if (melp->remaining_bits == 0)
-      {
-        if (melp->pos >= melp->buf_size)
-          grk::GRK_ERROR( "mel encoder's buffer is full");
+      int bits = melp->last_ff ? 7 : 8;
+      ui32 v = (ui32)(melp->tmp >> (melp->used_bits - bits));
+      v &= (1u << bits) - 1;
+      if (melp->pos >= melp->buf_size)
+        grk::GRK_ERROR( "mel encoder's buffer is full");
+      else
+        melp->buf[melp->pos++] = (ui8)v;
+      melp->used_bits -= bits;
+      melp->last_ff = v == 0xFF;
+    }
 
-        melp->buf[melp->pos++] = (ui8)melp->tmp;
-        melp->remaining_bits = (melp->tmp == 0xFF ? 7 : 8);
-        melp->tmp = 0;
+    //////////////////////////////////////////////////////////////////////////
+    // MEL bits go out most significant first
+    static inline void
+    mel_emit_bits(mel_struct* melp, int v, int num_bits)
+    {
+      melp->tmp = (melp->tmp << num_bits) | (ui32)v;
+      melp->used_bits += num_bits;
+      if (melp->used_bits < 32)
+        return;
+
+      ui32 w = (ui32)(melp->tmp >> (melp->used_bits - 32));
+      if (!melp->last_ff && !has_ff_byte(w)
+          && melp->pos + 4 <= melp->buf_size)
+      {
+        ui8 *dp = melp->buf + melp->pos;
+        dp[0] = (ui8)(w >> 24);
+        dp[1] = (ui8)(w >> 16);
+        dp[2] = (ui8)(w >> 8);
+        dp[3] = (ui8)w;
+        melp->pos += 4;
+        melp->used_bits -= 32;
       }
+      else
+        while (melp->used_bits >= 8)
+          mel_emit_byte(melp);
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -280,7 +245,7 @@ namespace ojph {
         ++melp->run;
         if (melp->run >= melp->threshold)
         {
-          mel_emit_bit(melp, 1);
+          mel_emit_bits(melp, 1, 1);
           melp->run = 0;
           melp->k = ojph_min(12, melp->k + 1);
           melp->threshold = 1 << mel_exp[melp->k];
@@ -288,10 +253,9 @@ namespace ojph {
       }
       else
       {
-        mel_emit_bit(melp, 0);
+        //a 0, followed by the run length in mel_exp[k] bits
         int t = mel_exp[melp->k];
-        while (t > 0)
-          mel_emit_bit(melp, (melp->run >> --t) & 1);
+        mel_emit_bits(melp, melp->run & ((1 << t) - 1), t + 1);
         melp->run = 0;
         melp->k = ojph_max(0, melp->k - 1);
         melp->threshold = 1 << mel_exp[melp->k];
@@ -307,8 +271,8 @@ namespace ojph {
       ui32 pos;      //position of next writing within buf
       ui32 buf_size; //size of buffer, which we must not exceed
 
-      int used_bits; //number of occupied bits in tmp
-      int tmp;       //temporary storage of coded bits
+      ui64 tmp;      //coded bits not yet written, the earliest in the LSB
+      int used_bits; //number of coded bits in tmp
       bool last_greater_than_8F; //true if last byte us greater than 0x8F
     };
 
@@ -327,35 +291,63 @@ namespace ojph {
     }
 
     //////////////////////////////////////////////////////////////////////////
+    // writes the next byte; after a byte above 0x8F, 7 set bits are written
+    // as 0x7F, and any other 7 bits get an eighth one
     static inline void
-    vlc_encode(vlc_struct* vlcp, int cwd, int cwd_len)
+    vlc_emit_byte(vlc_struct* vlcp)
     {
-      while (cwd_len > 0)
+      int bits = 8;
+      ui32 v = (ui32)vlcp->tmp & 0xFF;
+      if (vlcp->last_greater_than_8F && (v & 0x7F) == 0x7F)
       {
-        if (vlcp->pos >= vlcp->buf_size)
-          grk::GRK_ERROR( "vlc encoder's buffer is full");
+        bits = 7;
+        v = 0x7F;
+      }
+      if (vlcp->pos >= vlcp->buf_size)
+        grk::GRK_ERROR( "vlc encoder's buffer is full");
+      else
+        *(vlcp->buf - vlcp->pos++) = (ui8)v;
+      vlcp->tmp >>= bits;
+      vlcp->used_bits -= bits;
+      vlcp->last_greater_than_8F = v > 0x8F;
+    }
 
-        int avail_bits = 8 - vlcp->last_greater_than_8F - vlcp->used_bits;
-        int t = ojph_min(avail_bits, cwd_len);
-        vlcp->tmp |= (cwd & ((1 << t) - 1)) << vlcp->used_bits;
-        vlcp->used_bits += t;
-        avail_bits -= t;
-        cwd_len -= t;
-        cwd >>= t;
-        if (avail_bits == 0)
-        {
-          if (vlcp->last_greater_than_8F && vlcp->tmp != 0x7F)
-          {
-            vlcp->last_greater_than_8F = false;
-            continue; //one empty bit remaining
-          }
-          *(vlcp->buf - vlcp->pos) = (ui8)(vlcp->tmp);
-          vlcp->pos++;
-          vlcp->last_greater_than_8F = vlcp->tmp > 0x8F;
-          vlcp->tmp = 0;
-          vlcp->used_bits = 0;
-        }
+    //////////////////////////////////////////////////////////////////////////
+    // writes the bytes that are complete; 7 bits are enough for a 0x7F
+    static inline void
+    vlc_flush(vlc_struct* vlcp)
+    {
+      while (vlcp->used_bits >= 8
+             || (vlcp->used_bits == 7 && vlcp->last_greater_than_8F
+                 && (vlcp->tmp & 0x7F) == 0x7F))
+        vlc_emit_byte(vlcp);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    static inline void
+    vlc_encode(vlc_struct* vlcp, int cwd, int cwd_len)
+    {
+      vlcp->tmp |= (ui64)(cwd & ((1 << cwd_len) - 1)) << vlcp->used_bits;
+      vlcp->used_bits += cwd_len;
+      if (vlcp->used_bits < 32)
+        return;
+
+      ui32 w = (ui32)vlcp->tmp;
+      if (!has_ff_byte(w | 0x80808080u) && vlcp->pos + 4 <= vlcp->buf_size)
+      {
+        ui8 *dp = vlcp->buf - vlcp->pos;
+        dp[0] = (ui8)w;
+        dp[-1] = (ui8)(w >> 8);
+        dp[-2] = (ui8)(w >> 16);
+        dp[-3] = (ui8)(w >> 24);
+        vlcp->pos += 4;
+        vlcp->last_greater_than_8F = (w >> 24) > 0x8F;
+        vlcp->tmp >>= 32;
+        vlcp->used_bits -= 32;
       }
+      else
+        while (vlcp->used_bits >= 8)
+          vlc_emit_byte(vlcp);
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -365,19 +357,25 @@ namespace ojph {
     terminate_mel_vlc(mel_struct* melp, vlc_struct* vlcp)
     {
       if (melp->run > 0)
-        mel_emit_bit(melp, 1);
-
-      melp->tmp = melp->tmp << melp->remaining_bits;
-      int mel_mask = (0xFF << melp->remaining_bits) & 0xFF;
+        mel_emit_bits(melp, 1, 1);
+      while (melp->used_bits >= (melp->last_ff ? 7 : 8))
+        mel_emit_byte(melp);
+      vlc_flush(vlcp);
+
+      int remaining_bits = (melp->last_ff ? 7 : 8) - melp->used_bits;
+      int mel_tmp = (int)(melp->tmp & ((1u << melp->used_bits) - 1));
+      mel_tmp <<= remaining_bits;
+      int vlc_tmp = (int)vlcp->tmp;
+      int mel_mask = (0xFF << remaining_bits) & 0xFF;
       int vlc_mask = 0xFF >> (8 - vlcp->used_bits);
       if ((mel_mask | vlc_mask) == 0)
         return;  //last mel byte cannot be 0xFF, since then
-                 //melp->remaining_bits would be < 8
+                 //remaining_bits would be < 8
       if (melp->pos >= melp->buf_size)
         grk::GRK_ERROR( "mel encoder's buffer is full");
-      int fuse = melp->tmp | vlcp->tmp;
-      if ( ( ((fuse ^ melp->tmp) & mel_mask)
-           | ((fuse ^ vlcp->tmp) & vlc_mask) ) == 0
+      int fuse = mel_tmp | vlc_tmp;
+      if ( ( ((fuse ^ mel_tmp) & mel_mask)
+           | ((fuse ^ vlc_tmp) & vlc_mask) ) == 0
           && (fuse != 0xFF) && vlcp->pos > 1)
       {
         melp->buf[melp->pos++] = (ui8)fuse;
@@ -386,8 +384,8 @@ namespace ojph {
       {
         if (vlcp->pos >= vlcp->buf_size)
           grk::GRK_ERROR( "vlc encoder's buffer is full");
-        melp->buf[melp->pos++] = (ui8)melp->tmp; //melp->tmp cannot be 0xFF
-        *(vlcp->buf - vlcp->pos) = (ui8)vlcp->tmp;
+        melp->buf[melp->pos++] = (ui8)mel_tmp; //mel_tmp cannot be 0xFF
+        *(vlcp->buf - vlcp->pos) = (ui8)vlc_tmp;
         vlcp->pos++;
       }
     }
@@ -401,9 +399,9 @@ namespace ojph {
       ui32 pos;      //position of next writing within buf
       ui32 buf_size; //size of buffer, which we must not exceed
 
-      int max_bits;  //maximum number of bits that can be store in tmp
-      int used_bits; //number of occupied bits in tmp
-      ui32 tmp;      //temporary storage of coded bits
+      ui64 tmp;      //coded bits not yet written, the earliest in the LSB
+      int used_bits; //number of coded bits in tmp
+      bool last_ff;  //true if the last byte written is 0xFF
     };
 
     //////////////////////////////////////////////////////////////////////////
@@ -413,54 +411,354 @@ namespace ojph {
       msp->buf = data;
       msp->pos = 0;
       msp->buf_size = buffer_size;
-      msp->max_bits = 8;
-      msp->used_bits = 0;
       msp->tmp = 0;
+      msp->used_bits = 0;
+      msp->last_ff = false;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // writes the next byte, which holds 7 bits after a 0xFF and 8 otherwise
+    static inline void
+    ms_emit_byte(ms_struct* msp)
+    {
+      int bits = msp->last_ff ? 7 : 8;
+      ui32 v = (ui32)msp->tmp & ((1u << bits) - 1);
+      if (msp->pos >= msp->buf_size)
+        grk::GRK_ERROR( "magnitude sign encoder's buffer is full");
+      else
+        msp->buf[msp->pos++] = (ui8)v;
+      msp->tmp >>= bits;
+      msp->used_bits -= bits;
+      msp->last_ff = v == 0xFF;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // writes the bytes that are complete
+    static inline void
+    ms_flush(ms_struct* msp)
+    {
+      while (msp->used_bits >= (msp->last_ff ? 7 : 8))
+        ms_emit_byte(msp);
     }
 
     //////////////////////////////////////////////////////////////////////////
     static inline void
     ms_encode(ms_struct* msp, ui32 cwd, int cwd_len)
     {
-      while (cwd_len > 0)
+      msp->tmp |= ((ui64)cwd & ((1ULL << cwd_len) - 1)) << msp->used_bits;
+      msp->used_bits += cwd_len;
+      if (msp->used_bits < 32)
+        return;
+
+      ui32 w = (ui32)msp->tmp;
+      if (!msp->last_ff && !has_ff_byte(w) && msp->pos + 4 <= msp->buf_size)
       {
-        if (msp->pos >= msp->buf_size)
-          grk::GRK_ERROR( "magnitude sign encoder's buffer is full");
-        int t = ojph_min(msp->max_bits - msp->used_bits, cwd_len);
-        msp->tmp |= (cwd & ((1U << t) - 1)) << msp->used_bits;
-        msp->used_bits += t;
-        cwd >>= t;
-        cwd_len -= t;
-        if (msp->used_bits >= msp->max_bits)
-        {
-          msp->buf[msp->pos++] = (ui8)msp->tmp;
-          msp->max_bits = (msp->tmp == 0xFF) ? 7 : 8;
-          msp->tmp = 0;
-          msp->used_bits = 0;
-        }
+        ui8 *dp = msp->buf + msp->pos;
+        dp[0] = (ui8)w;
+        dp[1] = (ui8)(w >> 8);
+        dp[2] = (ui8)(w >> 16);
+        dp[3] = (ui8)(w >> 24);
+        msp->pos += 4;
+        msp->tmp >>= 32;
+        msp->used_bits -= 32;
       }
+      else
+        while (msp->used_bits >= 8)
+          ms_emit_byte(msp);
     }
 
     //////////////////////////////////////////////////////////////////////////
     static inline void
     ms_terminate(ms_struct* msp)
     {
+      ms_flush(msp);
       if (msp->used_bits)
       {
-        int t = msp->max_bits - msp->used_bits; //unused bits
-        msp->tmp |= (0xFF & ((1U << t) - 1)) << msp->used_bits;
-        msp->used_bits += t;
-        if (msp->tmp != 0xFF)
+        int max_bits = msp->last_ff ? 7 : 8;
+        int t = max_bits - msp->used_bits; //unused bits
+        ui32 v = (ui32)msp->tmp | ((0xFFu >> (8 - t)) << msp->used_bits);
+        if (v != 0xFF)
         {
           if (msp->pos >= msp->buf_size)
             grk::GRK_ERROR( "magnitude sign encoder's buffer is full");
-          msp->buf[msp->pos++] = (ui8)msp->tmp;
+          msp->buf[msp->pos++] = (ui8)v;
         }
       }
-      else if (msp->max_bits == 7)
+      else if (msp->last_ff)
         msp->pos--;
     }
 
+    //////////////////////////////////////////////////////////////////////////
+    // The SigProp pass uses the MagSgn writer; unused bits are set to 0
+    // because the decoder feeds zeros once the pass is exhausted, and a
+    // final 0xFF is followed by a zero byte so the pass never ends in 0xFF
+    //////////////////////////////////////////////////////////////////////////
+    static inline void
+    sp_terminate(ms_struct* spp)
+    {
+      ms_flush(spp);
+      if (spp->used_bits || spp->last_ff)
+      {
+        if (spp->pos >= spp->buf_size)
+          grk::GRK_ERROR( "sigprop encoder's buffer is full");
+        spp->buf[spp->pos++] = (ui8)spp->tmp;
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // The MagRef pass is written backwards from the end of the refinement
+    // segment with the VLC writer, but without the interface locator nibble
+    //////////////////////////////////////////////////////////////////////////
+    static inline void
+    mr_init(vlc_struct* mrp, ui32 buffer_size, ui8* data)
+    {
+      mrp->buf = data + buffer_size - 1; //points to last byte
+      mrp->pos = 0;                      //locations will be all -pos
+      mrp->buf_size = buffer_size;
+
+      mrp->used_bits = 0;
+      mrp->tmp = 0;
+      mrp->last_greater_than_8F = true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    static inline void
+    mr_terminate(vlc_struct* mrp)
+    {
+      vlc_flush(mrp);
+      if (mrp->used_bits)
+      {
+        if (mrp->pos >= mrp->buf_size)
+          grk::GRK_ERROR( "magref encoder's buffer is full");
+        *(mrp->buf - mrp->pos) = (ui8)(mrp->tmp); //cannot be 0xFF
+        mrp->pos++;
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Encodes the SigProp and, for num_passes of 3, the MagRef pass of
+    // bitplane p - 1, visiting samples in the same order as
+    // ojph_decode_sigprop_magref does.  sigma holds the cleanup pass
+    // significance of 4 rows by 4 columns in each ui16, as in the decoder.
+    // dist receives the distortion reduction of the two passes, in units
+    // of (2^p)^2.  sigma and prev_row_sig live in work
+    //////////////////////////////////////////////////////////////////////////
+    static void
+    encode_sigprop_magref(const ui32* buf, ui32 p, ui32 num_passes,
+                          ui32 width, ui32 height, ui32 stride,
+                          bool stripe_causal, ms_struct* spp,
+                          vlc_struct* mrp, float dist[2],
+                          encode_scratch* work)
+    {
+      const float scale = std::ldexp(1.0f, -(int)p);
+      float sp_dist = 0.0f, mr_dist = 0.0f;
+
+      //codeblock dimensions are powers of 2 from 4 to 1024, with at most
+      //4096 samples; that is up to 256 entries of 4x4 samples, and at most
+      //256 entries per stripe or 256 stripes.  Each stripe gets two extra
+      //entries on the right, and an extra stripe is added below
+      ui16 *sigma = work->sigma;
+      ui16 *prev_row_sig = work->prev_row_sig;
+      const ui32 mstr = ((width + 3u) >> 2) + 2u;
+      const ui32 num_stripes = (height + 3u) >> 2;
+
+      for (ui32 y = 0; y < height; y += 4)
+      {
+        ui16 *dp = sigma + (y >> 2) * mstr;
+        for (ui32 x = 0; x < width; x += 4, ++dp)
+        {
+          ui32 t = 0;
+          for (ui32 i = 0; i < 4 && x + i < width; ++i)
+            for (ui32 j = 0; j < 4 && y + j < height; ++j)
+              if ((buf[(y + j) * stride + x + i] & 0x7FFFFFFFu) >> p)
+                t |= 1u << (4 * i + j);
+          dp[0] = (ui16)t;
+        }
+        dp[0] = dp[1] = 0;
+      }
+      memset(sigma + num_stripes * mstr, 0, mstr * sizeof(ui16));
+      memset(prev_row_sig, 0, (((width + 3u) >> 2) + 1u) * sizeof(ui16));
+
+      //SigProp pass
+      for (ui32 y = 0; y < height; y += 4)
+      {
+        ui32 pattern = 0xFFFFu; // a pattern needed samples
+        if (height - y < 4) {
+          pattern = 0x7777u;
+          if (height - y < 3) {
+            pattern = 0x3333u;
+            if (height - y < 2)
+              pattern = 0x1111u;
+          }
+        }
+
+        ui32 prev = 0;
+        ui16 *prev_sig = prev_row_sig;
+        ui16 *cur_sig = sigma + (y >> 2) * mstr;
+        const ui32 *row = buf + y * stride;
+        for (ui32 x = 0; x < width; x += 4, ++cur_sig, ++prev_sig)
+        {
+          si32 s = (si32)x + 4 - (si32)width;
+          s = ojph_max(s, 0);
+          pattern = pattern >> (s * 4);
+
+          //potential SigProp members, found exactly as the decoder does
+          ui32 ps = prev_sig[0] | ((ui32)prev_sig[1] << 16);
+          ui32 ns = cur_sig[mstr] | ((ui32)cur_sig[mstr + 1] << 16);
+          ui32 u = (ps & 0x88888888) >> 3; // the row on top
+          if (!stripe_causal)
+            u |= (ns & 0x11111111) << 3;   // the row below
+
+          ui32 cs = cur_sig[0] | ((ui32)cur_sig[1] << 16);
+          ui32 mbr =  cs;
+          mbr |= (cs & 0x77777777) << 1; //above neighbors
+          mbr |= (cs & 0xEEEEEEEE) >> 1; //below neighbors
+          mbr |= u;
+          ui32 t = mbr;
+          mbr |= t << 4;      // neighbors on the left
+          mbr |= t >> 4;      // neighbors on the right
+          mbr |= prev >> 12;  // significance of previous group
+
+          mbr &= pattern;
+          mbr &= ~cs;
+
+          ui32 new_sig = mbr;
+          if (new_sig)
+          {
+            //one bit per member; a sample that becomes significant makes
+            //its unvisited neighbors members
+            static const ui32 spread[4] = { 0x33u, 0x76u, 0xECu, 0xC8u };
+            ui32 inv_sig = ~cs & pattern;
+            for (int i = 0; i < 16; i += 4)
+            {
+              const ui32 *sp = row + x + (ui32)(i >> 2);
+              for (int j = 0; j < 4; ++j)
+              {
+                ui32 sample_mask = 1u << (i + j);
+                if ((new_sig & sample_mask) == 0)
+                  continue;
+                new_sig &= ~sample_mask;
+                ui32 mag = sp[(ui32)j * stride] & 0x7FFFFFFFu;
+                ui32 bit = (mag >> (p - 1)) & 1;
+                ms_encode(spp, bit, 1);
+                if (bit)
+                {
+                  new_sig |= (spread[j] << i) & inv_sig;
+                  //from 0 to 3/4 of 2^p
+                  float v = (float)mag * scale;
+                  sp_dist += 0.75f * (2.0f * v - 0.75f);
+                }
+              }
+            }
+
+            //signs of the samples that became significant
+            for (int i = 0; i < 16; i += 4)
+            {
+              const ui32 *sp = row + x + (ui32)(i >> 2);
+              for (int j = 0; j < 4; ++j)
+                if (new_sig & (1u << (i + j)))
+                  ms_encode(spp, sp[(ui32)j * stride] >> 31, 1);
+            }
+          }
+
+          new_sig |= cs;
+          *prev_sig = (ui16)(new_sig);
+
+          t = new_sig;
+          new_sig |= (t & 0x7777) << 1; //above neighbors
+          new_sig |= (t & 0xEEEE) >> 1; //below neighbors
+          prev = new_sig | u;
+          prev &= 0xF000;
+        }
+      }
+      sp_terminate(spp);
+
+      //MagRef pass, over the samples that are significant in the cleanup
+      if (num_passes > 2)
+      {
+        for (ui32 y = 0; y < height; y += 4)
+        {
+          const ui16 *cur_sig = sigma + (y >> 2) * mstr;
+          for (ui32 x = 0; x < width; x += 4, ++cur_sig)
+          {
+            ui32 sig = *cur_sig;
+            for (ui32 i = 0; sig; ++i, sig >>= 4)
+            {
+              const ui32 *sp = buf + y * stride + x + i;
+              for (ui32 j = 0; j < 4; ++j)
+                if (sig & (1u << j))
+                {
+                  ui32 mag = sp[j * stride] & 0x7FFFFFFFu;
+                  vlc_encode(mrp, (int)((mag >> (p - 1)) & 1), 1);
+                  //the reconstruction moves by a quarter of 2^p
+                  float v = (float)mag * scale;
+                  float d0 = v - ((float)(mag >> p) + 0.5f);
+                  float d1 = v - ((float)(mag >> (p - 1)) + 0.5f) * 0.5f;
+                  mr_dist += d0 * d0 - d1 * d1;
+                }
+            }
+          }
+        }
+        mr_terminate(mrp);
+      }
+      dist[0] = sp_dist;
+      dist[1] = mr_dist;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Finds E_n and v_n of each sample, and rho and the largest E_n of each
+    // quad, for the quads of rows sp and sp + stride
+    //////////////////////////////////////////////////////////////////////////
+    static void
+    analyze_quad_row(const ui32* sp, ui32 stride, ui32 width, bool two_rows,
+                     ui32 p, quad_row_info* qr)
+    {
+      const ui32 *sp1 = two_rows ? sp + stride : NULL;
+      ui32 padded_width = (width + 7u) & ~7u;
+      const float scale = std::ldexp(1.0f, -(int)p);
+      float dist = 0.0f;
+      si32 *e = qr->e_q;
+      ui32 *v = qr->s;
+      for (ui32 x = 0; x < padded_width; x += 2, e += 4, v += 4)
+      {
+        //the 4 samples of a quad; those outside the codeblock are 0
+        ui32 t[4] = {0, 0, 0, 0};
+        if (x < width)
+        {
+          t[0] = sp[x];
+          t[1] = sp1 ? sp1[x] : 0;
+          if (x + 1 < width)
+          {
+            t[2] = sp[x + 1];
+            t[3] = sp1 ? sp1[x + 1] : 0;
+          }
+        }
+        int rho = 0, e_qmax = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+          ui32 val = t[i] + t[i]; //multiply by 2 and get rid of sign
+          val >>= p;  // 2 \mu_p + x
+          val &= ~1u; // 2 \mu_p
+          e[i] = 0;
+          v[i] = 0;
+          if (val)
+          {
+            //from 0 to (\mu_p + 1/2) 2^p
+            float q = (float)(val >> 1) + 0.5f;
+            float mag = (float)(t[i] & 0x7FFFFFFFu) * scale;
+            dist += q * (2.0f * mag - q);
+            rho |= 1 << i;
+            e[i] = 32 - (si32)count_leading_zeros(--val); //2\mu_p - 1
+            e_qmax = ojph_max(e_qmax, e[i]);
+            v[i] = --val + (t[i] >> 31); //v_n = 2(\mu_p-1) + s_n
+          }
+        }
+        qr->rho[x >> 1] = (ui8)rho;
+        qr->e_qmax[x >> 1] = (ui8)e_qmax;
+      }
+      qr->dist = dist;
+    }
+
     //////////////////////////////////////////////////////////////////////////
     //
     //
@@ -468,31 +766,51 @@ namespace ojph {
     //
     //
     //////////////////////////////////////////////////////////////////////////
-    void ojph_encode_codeblock(ui32* buf, ui32 missing_msbs, ui32 num_passes,
-                               ui32 width, ui32 height, ui32 stride,
-                               ui32* lengths,
-                               ojph::mem_elastic_allocator *elastic,
-                               ojph::coded_lists *& coded)
+    // the passes are written to out, which can hold out_size bytes, if
+    // to_out is true, and to a buffer obtained from elastic otherwise; the
+    // unused destination is not accessed
+    template<quad_analysis_fn analyze, bool to_out>
+    static bool encode_codeblock(ui32* buf, ui32 missing_msbs,
+                                 ui32 num_passes, ui32 width, ui32 height,
+                                 ui32 stride, bool stripe_causal,
+                                 ui32* lengths, float* distortion,
+                                 ui8* out, ui32 out_size,
+                                 ojph::mem_elastic_allocator *elastic,
+                                 ojph::coded_lists *& coded,
+                                 encode_scratch* work)
     {
-      assert(num_passes == 1);
-      (void)num_passes;                      //currently not used
-      const int ms_size = (16384*16+14)/15;  //more than enough
-      ui8 ms_buf[ms_size];
-      const int mel_vlc_size = 3072;         //more than enough
-      ui8 mel_vlc_buf[mel_vlc_size];
+      assert(num_passes >= 1 && num_passes <= 3);
+      assert(num_passes == 1 || missing_msbs <= 28); //p - 1 must exist
+      const int ms_size = (int)sizeof(work->ms_buf);  //more than enough
+      ui8 *ms_buf = work->ms_buf;
+      const int mel_vlc_size = (int)sizeof(work->mel_vlc_buf);
       const int mel_size = 192;
-      ui8 *mel_buf = mel_vlc_buf;
+      ui8 *mel_buf = work->mel_vlc_buf;
       const int vlc_size = mel_vlc_size - mel_size;
-      ui8 *vlc_buf = mel_vlc_buf + mel_size;
+      ui8 *vlc_buf = work->mel_vlc_buf + mel_size;
+      //refinement passes; at most 2 bits per sample for SigProp and 1 bit
+      //for MagRef, with one stuffed bit every 7 bits
+      const int sigprop_size = (int)sizeof(work->sigprop_buf);
+      const int magref_size = (int)sizeof(work->magref_buf);
+
+      ui32 p = 30 - missing_msbs;
+
+      //MagSgn, which is most of the cleanup pass, goes straight to out
+      //when out can hold the worst case for bitplane p, that is, 32 - p
+      //bits per sample with one stuffed bit every 7 bits; it is put
+      //together in ms_buf otherwise
+      ui32 ms_bound = (width * height * (32 - p) + 6) / 7 + 1;
+      bool direct = to_out && ms_bound <= out_size;
 
       mel_struct mel;
       mel_init(&mel, mel_size, mel_buf);
       vlc_struct vlc;
       vlc_init(&vlc, vlc_size, vlc_buf);
       ms_struct ms;
-      ms_init(&ms, ms_size, ms_buf);
-
-      ui32 p = 30 - missing_msbs;
+      if (direct)
+        ms_init(&ms, ms_bound, out);
+      else
+        ms_init(&ms, ms_size, ms_buf);
 
       //e_val: E values for a line (these are the highest set bit)
       //cx_val: is the context values
@@ -503,73 +821,27 @@ namespace ojph {
       //For a 1024 pixels, we need 512 bytes, the 2 extra,
       // one for the non-existing earlier quad, and one for beyond the
       // the end
-      ui8 e_val[513];
-      ui8 cx_val[513];
+      ui8 *e_val = work->e_val;
+      ui8 *cx_val = work->cx_val;
       ui8* lep = e_val;     lep[0] = 0;
       ui8* lcxp = cx_val;   lcxp[0] = 0;
 
       //initial row of quads
-      int e_qmax[2] = {0,0}, e_q[8] = {0,0,0,0,0,0,0,0};
-      int rho[2] = {0,0};
+      quad_row_info &qr = work->qr;
+      int e_qmax[2] = {0,0}, rho[2] = {0,0};
+      const si32 *e_q;
+      const ui32 *s;
       int c_q0 = 0;
-      ui32 s[8] = {0,0,0,0,0,0,0,0}, val, t;
       ui32 y = 0;
-      ui32 *sp = buf;
+      analyze(buf, stride, width, height > 1, p, &qr);
+      float cleanup_dist = qr.dist;
       for (ui32 x = 0; x < width; x += 4)
       {
-        //prepare two quads
-        t = sp[0];
-        val = t + t; //multiply by 2 and get rid of sign
-        val >>= p;  // 2 \mu_p + x
-        val &= ~1u; // 2 \mu_p
-        if (val)
-        {
-          rho[0] = 1;
-          e_q[0] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-          e_qmax[0] = e_q[0];
-          s[0] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-        }
-
-        t = height > 1 ? sp[stride] : 0;
-        ++sp;
-        val = t + t; //multiply by 2 and get rid of sign
-        val >>= p; // 2 \mu_p + x
-        val &= ~1u;// 2 \mu_p
-        if (val)
-        {
-          rho[0] += 2;
-          e_q[1] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-          e_qmax[0] = ojph_max(e_qmax[0], e_q[1]);
-          s[1] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-        }
-
-        if (x+1 < width)
-        {
-          t = sp[0];
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[0] += 4;
-            e_q[2] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[0] = ojph_max(e_qmax[0], e_q[2]);
-            s[2] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-
-          t = height > 1 ? sp[stride] : 0;
-          ++sp;
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[0] += 8;
-            e_q[3] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[0] = ojph_max(e_qmax[0], e_q[3]);
-            s[3] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-        }
+        //two quads, analyzed already
+        rho[0] = qr.rho[x >> 1];     rho[1] = qr.rho[(x >> 1) + 1];
+        e_qmax[0] = qr.e_qmax[x >> 1]; e_qmax[1] = qr.e_qmax[(x >> 1) + 1];
+        e_q = qr.e_q + 2 * x;
+        s = qr.s + 2 * x;
 
         int Uq0 = ojph_max(e_qmax[0], 1); //kappa_q = 1
         int u_q0 = Uq0 - 1, u_q1 = 0; //kappa_q = 1
@@ -604,59 +876,6 @@ namespace ojph {
 
         if (x+2 < width)
         {
-          t = sp[0];
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[1] = 1;
-            e_q[4] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[1] = e_q[4];
-            s[4] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-
-          t = height > 1 ? sp[stride] : 0;
-          ++sp;
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[1] += 2;
-            e_q[5] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[1] = ojph_max(e_qmax[1], e_q[5]);
-            s[5] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-
-          if (x+3 < width)
-          {
-            t = sp[0];
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[1] += 4;
-              e_q[6] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[1] = ojph_max(e_qmax[1], e_q[6]);
-              s[6] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-
-            t = height > 1 ? sp[stride] : 0;
-            ++sp;
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[1] += 8;
-              e_q[7] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[1] = ojph_max(e_qmax[1], e_q[7]);
-              s[7] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-          }
-
           int c_q1 = (rho[0] >> 1) | (rho[0] & 1);
           int Uq1 = ojph_max(e_qmax[1], 1); //kappa_q = 1
           u_q1 = Uq1 - 1; //kappa_q = 1
@@ -715,9 +934,6 @@ namespace ojph {
 
         //prepare for next iteration
         c_q0 = (rho[1] >> 1) | (rho[1] & 1);
-        s[0] = s[1] = s[2] = s[3] = s[4] = s[5] = s[6] = s[7] = 0;
-        e_q[0]=e_q[1]=e_q[2]=e_q[3]=e_q[4]=e_q[5]=e_q[6]=e_q[7]=0;
-        rho[0] = rho[1] = 0; e_qmax[0] = e_qmax[1] = 0;
       }
 
       lep[1] = 0;
@@ -731,62 +947,15 @@ namespace ojph {
         c_q0 = lcxp[0] + (lcxp[1] << 2);
         lcxp[0] = 0;
 
-        sp = buf + y * stride;
+        analyze(buf + y * stride, stride, width, y + 1 < height, p, &qr);
+        cleanup_dist += qr.dist;
         for (ui32 x = 0; x < width; x += 4)
         {
-          //prepare two quads
-          t = sp[0];
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[0] = 1;
-            e_q[0] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[0] = e_q[0];
-            s[0] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-
-          t = y + 1 < height ? sp[stride] : 0;
-          ++sp;
-          val = t + t; //multiply by 2 and get rid of sign
-          val >>= p; // 2 \mu_p + x
-          val &= ~1u;// 2 \mu_p
-          if (val)
-          {
-            rho[0] += 2;
-            e_q[1] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-            e_qmax[0] = ojph_max(e_qmax[0], e_q[1]);
-            s[1] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-          }
-
-          if (x+1 < width)
-          {
-            t = sp[0];
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[0] += 4;
-              e_q[2] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[0] = ojph_max(e_qmax[0], e_q[2]);
-              s[2] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-
-            t = y + 1 < height ? sp[stride] : 0;
-            ++sp;
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[0] += 8;
-              e_q[3] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[0] = ojph_max(e_qmax[0], e_q[3]);
-              s[3] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-          }
+          //two quads, analyzed already
+          rho[0] = qr.rho[x >> 1];     rho[1] = qr.rho[(x >> 1) + 1];
+          e_qmax[0] = qr.e_qmax[x >> 1]; e_qmax[1] = qr.e_qmax[(x >> 1) + 1];
+          e_q = qr.e_q + 2 * x;
+          s = qr.s + 2 * x;
 
           int kappa = (rho[0] & (rho[0]-1)) ? ojph_max(1,max_e) : 1;
           int Uq0 = ojph_max(e_qmax[0], kappa);
@@ -823,59 +992,6 @@ namespace ojph {
 
           if (x+2 < width)
           {
-            t = sp[0];
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[1] = 1;
-              e_q[4] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[1] = e_q[4];
-              s[4] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-
-            t = y + 1 < height ? sp[stride] : 0;
-            ++sp;
-            val = t + t; //multiply by 2 and get rid of sign
-            val >>= p; // 2 \mu_p + x
-            val &= ~1u;// 2 \mu_p
-            if (val)
-            {
-              rho[1] += 2;
-              e_q[5] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-              e_qmax[1] = ojph_max(e_qmax[1], e_q[5]);
-              s[5] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-            }
-
-            if (x+3 < width)
-            {
-              t = sp[0];
-              val = t + t; //multiply by 2 and get rid of sign
-              val >>= p; // 2 \mu_p + x
-              val &= ~1u;// 2 \mu_p
-              if (val)
-              {
-                rho[1] += 4;
-                e_q[6] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-                e_qmax[1] = ojph_max(e_qmax[1], e_q[6]);
-                s[6] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-              }
-
-              t = y + 1 < height ? sp[stride] : 0;
-              ++sp;
-              val = t + t; //multiply by 2 and get rid of sign
-              val >>= p; // 2 \mu_p + x
-              val &= ~1u;// 2 \mu_p
-              if (val)
-              {
-                rho[1] += 8;
-                e_q[7] = 32 - (int)count_leading_zeros(--val); //2\mu_p - 1
-                e_qmax[1] = ojph_max(e_qmax[1], e_q[7]);
-                s[7] = --val + (t >> 31); //v_n = 2(\mu_p-1) + s_n
-              }
-            }
-
             kappa = (rho[1] & (rho[1]-1)) ? ojph_max(1,max_e) : 1;
             c_q1 |= ((rho[0] & 4) >> 1) | ((rho[0] & 8) >> 2);
             int Uq1 = ojph_max(e_qmax[1], kappa);
@@ -918,9 +1034,6 @@ namespace ojph {
 
           //prepare for next iteration
           c_q0 |= ((rho[1] & 4) >> 1) | ((rho[1] & 8) >> 2);
-          s[0] = s[1] = s[2] = s[3] = s[4] = s[5] = s[6] = s[7] = 0;
-          e_q[0]=e_q[1]=e_q[2]=e_q[3]=e_q[4]=e_q[5]=e_q[6]=e_q[7]=0;
-          rho[0] = rho[1] = 0; e_qmax[0] = e_qmax[1] = 0;
         }
       }
 
@@ -928,21 +1041,149 @@ namespace ojph {
       terminate_mel_vlc(&mel, &vlc);
       ms_terminate(&ms);
 
-      //copy to elastic
+      ms_struct sigprop;
+      ms_init(&sigprop, sigprop_size, work->sigprop_buf);
+      vlc_struct magref;
+      mr_init(&magref, magref_size, work->magref_buf);
+      float refine_dist[2] = {0.0f, 0.0f};
+      if (num_passes > 1)
+      {
+        encode_sigprop_magref(buf, p, num_passes, width, height, stride,
+                              stripe_causal, &sigprop, &magref, refine_dist,
+                              work);
+        lengths[1] = sigprop.pos;
+        if (num_passes > 2)
+          lengths[2] = magref.pos;
+      }
+      if (distortion)
+      {
+        distortion[0] = cleanup_dist;
+        for (ui32 i = 1; i < num_passes; ++i)
+          distortion[i] = refine_dist[i - 1];
+      }
+
+      //put the passes together
       lengths[0] = mel.pos + vlc.pos + ms.pos;
-      elastic->get_buffer(mel.pos + vlc.pos + ms.pos, coded);
-      memcpy(coded->buf, ms.buf, ms.pos);
-      memcpy(coded->buf + ms.pos, mel.buf, mel.pos);
-      memcpy(coded->buf + ms.pos + mel.pos, vlc.buf - vlc.pos + 1, vlc.pos);
+      ui32 total = lengths[0] + sigprop.pos + magref.pos;
+      ui8 *dp;
+      if constexpr (to_out)
+      {
+        if (total > out_size)
+        {
+          grk::GRK_ERROR("HT codeblock does not fit in its output buffer");
+          return false;
+        }
+        dp = out;
+      }
+      else
+      {
+        elastic->get_buffer(total, coded);
+        coded->avail_size -= total;
+        dp = coded->buf;
+      }
+      if (!direct)
+        memcpy(dp, ms.buf, ms.pos);
+      memcpy(dp + ms.pos, mel.buf, mel.pos);
+      memcpy(dp + ms.pos + mel.pos, vlc.buf - vlc.pos + 1, vlc.pos);
+      memcpy(dp + lengths[0], sigprop.buf, sigprop.pos);
+      memcpy(dp + lengths[0] + sigprop.pos,
+             magref.buf - magref.pos + 1, magref.pos);
 
       // put in the interface locator word
       ui32 num_bytes = mel.pos + vlc.pos;
-      coded->buf[lengths[0]-1] = (ui8)(num_bytes >> 4);
-      coded->buf[lengths[0]-2] = coded->buf[lengths[0]-2] & 0xF0;
-      coded->buf[lengths[0]-2] = 
-        (ui8)(coded->buf[lengths[0]-2] | (num_bytes & 0xF));
+      dp[lengths[0]-1] = (ui8)(num_bytes >> 4);
+      dp[lengths[0]-2] = dp[lengths[0]-2] & 0xF0;
+      dp[lengths[0]-2] = (ui8)(dp[lengths[0]-2] | (num_bytes & 0xF));
+
+      return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    ui32 ojph_rev_tx_to_cb(const si32* src, ui32 src_stride, ui32* dest,
+                           ui32 width, ui32 height, ui32 shift)
+    {
+      ui32 or_val = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride)
+        for (ui32 x = 0; x < width; ++x)
+        {
+          si32 t = src[x];
+          ui32 val = (ui32)(t >= 0 ? t : -t) << shift;
+          ui32 sign = t >= 0 ? 0 : 0x80000000;
+          or_val |= val;
+          *dest++ = sign | val;
+        }
+      return or_val;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    ui32 ojph_irv_tx_to_cb(const si32* src, ui32 src_stride, ui32* dest,
+                           ui32 width, ui32 height, float scale)
+    {
+      const float max_val = 2147483520.0f; //largest float below 2^31
+      ui32 or_val = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride)
+        for (ui32 x = 0; x < width; ++x)
+        {
+          float t = (float)src[x] * scale;
+          float mag = std::fabs(t);
+          mag = mag < max_val ? mag : max_val;
+          //rounds to nearest, as the SIMD conversions do
+          ui32 val = (ui32)std::lrint(mag);
+          ui32 sign = t >= 0.0f ? 0 : 0x80000000;
+          or_val |= val;
+          *dest++ = sign | val;
+        }
+      return or_val;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    void ojph_encode_codeblock(ui32* buf, ui32 missing_msbs, ui32 num_passes,
+                               ui32 width, ui32 height, ui32 stride,
+                               bool stripe_causal, ui32* lengths,
+                               ojph::mem_elastic_allocator *elastic,
+                               ojph::coded_lists *& coded,
+                               encode_scratch* work)
+    {
+      encode_codeblock<analyze_quad_row, false>(buf, missing_msbs,
+                                                num_passes, width, height,
+                                                stride, stripe_causal,
+                                                lengths, NULL, NULL, 0,
+                                                elastic, coded, work);
+    }
 
-      coded->avail_size -= lengths[0];
+    //////////////////////////////////////////////////////////////////////////
+    bool ojph_encode_codeblock_direct(ui32* buf, ui32 missing_msbs,
+                                      ui32 num_passes, ui32 width,
+                                      ui32 height, ui32 stride,
+                                      bool stripe_causal, ui32* lengths,
+                                      float* distortion, ui8* out,
+                                      ui32 out_size, encode_scratch* work)
+    {
+      coded_lists *coded = NULL;
+      return encode_codeblock<analyze_quad_row, true>(buf, missing_msbs,
+                                                      num_passes, width,
+                                                      height, stride,
+                                                      stripe_causal, lengths,
+                                                      distortion, out,
+                                                      out_size, NULL, coded,
+                                                      work);
+    }
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+    //////////////////////////////////////////////////////////////////////////
+    bool ojph_encode_codeblock_direct_avx2(ui32* buf, ui32 missing_msbs,
+                                           ui32 num_passes, ui32 width,
+                                           ui32 height, ui32 stride,
+                                           bool stripe_causal, ui32* lengths,
+                                           float* distortion, ui8* out,
+                                           ui32 out_size,
+                                           encode_scratch* work)
+    {
+      coded_lists *coded = NULL;
+      return encode_codeblock<ojph_analyze_quad_row_avx2, true>(
+        buf, missing_msbs, num_passes, width, height, stride, stripe_causal,
+        lengths, distortion, out, out_size, NULL, coded, work);
     }
+#endif
   }
 }
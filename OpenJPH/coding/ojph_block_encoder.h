@@ -51,12 +51,113 @@ namespace ojph {
   namespace local {
 
     //////////////////////////////////////////////////////////////////////////
+    // convert the two's complement samples of a codeblock, read from src
+    // with a stride of src_stride, to the sign-magnitude form that the
+    // encoder takes; dest is contiguous.  The reversible variants shift the
+    // magnitudes up by shift, and the irreversible ones multiply the samples
+    // by scale, which includes that shift, and round to the nearest integer.
+    // All return the OR of the magnitudes written to dest
+    ui32 ojph_rev_tx_to_cb(const si32* src, ui32 src_stride, ui32* dest,
+                           ui32 width, ui32 height, ui32 shift);
+    ui32 ojph_irv_tx_to_cb(const si32* src, ui32 src_stride, ui32* dest,
+                           ui32 width, ui32 height, float scale);
+
+    // SSSE3-accelerated conversions
+    ui32 ojph_rev_tx_to_cb_ssse3(const si32* src, ui32 src_stride,
+                                 ui32* dest, ui32 width, ui32 height,
+                                 ui32 shift);
+    ui32 ojph_irv_tx_to_cb_ssse3(const si32* src, ui32 src_stride,
+                                 ui32* dest, ui32 width, ui32 height,
+                                 float scale);
+
+    // AVX2-accelerated conversions
+    ui32 ojph_rev_tx_to_cb_avx2(const si32* src, ui32 src_stride,
+                                ui32* dest, ui32 width, ui32 height,
+                                ui32 shift);
+    ui32 ojph_irv_tx_to_cb_avx2(const si32* src, ui32 src_stride,
+                                ui32* dest, ui32 width, ui32 height,
+                                float scale);
+
+    //////////////////////////////////////////////////////////////////////////
+    // the samples of two rows of a codeblock as the cleanup pass sees them;
+    // samples are in quad order, that is, for each column, the top sample
+    // followed by the bottom one, so quad q starts at entry 4q.  Entries
+    // beyond the codeblock width, up to a multiple of 8 columns, are zero
+    struct quad_row_info {
+      si32 e_q[2048];  // E_n, the number of bits in 2\mu_p - 1, or 0
+      ui32 s[2048];    // v_n = 2(\mu_p - 1) + s_n, or 0 if insignificant
+      ui8 rho[512];    // significance of the 4 samples of each quad
+      ui8 e_qmax[512]; // the largest E_n of each quad
+      float dist;      // distortion reduction of the cleanup pass for the
+                       // two rows, in units of (2^p)^2
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // memory the encoder works in, about 43 KB; the caller keeps one per
+    // thread and reuses it for every codeblock, so that encoding needs
+    // little stack.  Sizes are for codeblocks of at most 4096 samples and
+    // 1024 columns
+    struct alignas(32) encode_scratch
+    {
+      quad_row_info qr;                    // the quad row being coded
+      ui8 ms_buf[(16384 * 16 + 14) / 15];  // MagSgn, when not coded to out
+      ui8 mel_vlc_buf[3072];               // MEL, then VLC written backwards
+      ui8 e_val[514];                      // E of the row above, per 2 columns
+      ui8 cx_val[514];                     // significance of the row above
+      ui8 sigprop_buf[4096 * 2 / 7 + 2];   // at most 2 bits per sample
+      ui8 magref_buf[4096 / 7 + 2];        // at most 1 bit per sample
+      ui16 sigma[256 + 256 + 2 * 256 + 2]; // cleanup significance, 4x4 each
+      ui16 prev_row_sig[256 + 8];          // SigProp bits of the stripe above
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // fills qr from the rows at sp and sp + stride; the second row is
+    // treated as zero when two_rows is false
+    typedef void (*quad_analysis_fn)(const ui32* sp, ui32 stride,
+                                     ui32 width, bool two_rows, ui32 p,
+                                     quad_row_info* qr);
+
+    // AVX2-accelerated quad analysis
+    void ojph_analyze_quad_row_avx2(const ui32* sp, ui32 stride,
+                                    ui32 width, bool two_rows, ui32 p,
+                                    quad_row_info* qr);
+
+    //////////////////////////////////////////////////////////////////////////
+    // encodes the cleanup pass at bitplane p = 30 - missing_msbs and, for
+    // num_passes of 2 or 3, the SigProp and MagRef passes at bitplane p - 1;
+    // lengths receives one length per pass, and coded holds the passes
+    // back to back; work is overwritten
     void
       ojph_encode_codeblock(ui32* buf, ui32 missing_msbs, ui32 num_passes,
                             ui32 width, ui32 height, ui32 stride,
-                            ui32* lengths, 
+                            bool stripe_causal, ui32* lengths, 
                             ojph::mem_elastic_allocator *elastic,
-                            ojph::coded_lists *& coded);
+                            ojph::coded_lists *& coded,
+                            encode_scratch* work);
+
+    // writes the passes back to back into out, which can hold out_size
+    // bytes, without going through an elastic allocator; MagSgn is coded
+    // straight into out whenever out is large enough for its worst case.
+    // If distortion is not NULL, it receives the reduction in squared
+    // error that each pass brings, in units of (2^p)^2, assuming that
+    // the decoder reconstructs at the middle of the uncertainty interval.
+    // returns false if the passes do not fit
+    bool
+      ojph_encode_codeblock_direct(ui32* buf, ui32 missing_msbs,
+                                   ui32 num_passes, ui32 width, ui32 height,
+                                   ui32 stride, bool stripe_causal,
+                                   ui32* lengths, float* distortion,
+                                   ui8* out, ui32 out_size,
+                                   encode_scratch* work);
+
+    // uses AVX2 for the quad analysis
+    bool
+      ojph_encode_codeblock_direct_avx2(ui32* buf, ui32 missing_msbs,
+                                        ui32 num_passes, ui32 width,
+                                        ui32 height, ui32 stride,
+                                        bool stripe_causal, ui32* lengths,
+                                        float* distortion, ui8* out,
+                                        ui32 out_size, encode_scratch* work);
   }
 }
 
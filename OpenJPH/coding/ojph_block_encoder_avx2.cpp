@@ -0,0 +1,301 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    This source code incorporates work covered by the following license:
+ */
+// This software is released under the 2-Clause BSD license, included
+// below.
+//
+// Copyright (c) 2019, Aous Naman
+// Copyright (c) 2019, Kakadu Software Pty Ltd, Australia
+// Copyright (c) 2019, The University of New South Wales, Australia
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//***************************************************************************/
+// This file is part of the OpenJPH software implementation.
+// File: ojph_block_encoder.cpp
+// Author: Aous Naman
+// Date: 17 September 2019
+//***************************************************************************/
+
+//***************************************************************************/
+/** @file ojph_block_encoder_avx2.cpp
+ *  @brief implements the quad analysis and the sign-magnitude conversion
+ *         of the HTJ2K block encoder using AVX2
+ */
+
+#include <climits>
+
+#include "ojph_arch.h"
+#include "ojph_block_encoder.h"
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+#include <immintrin.h>
+
+namespace ojph {
+  namespace local {
+
+    //************************************************************************/
+    /** @brief Finds E_n, v_n and the significance of 8 samples
+     *
+     *  E_n is the number of bits in 2\mu_p - 1; AVX2 has no lzcnt, so it is
+     *  read from the exponent of a float.  The conversion is made exact by
+     *  dropping the bit that is known to be present, and by clearing the 8
+     *  least significant bits of values that do not fit in the mantissa.
+     *
+     *  @param [in]  t holds 8 samples in sign-magnitude form
+     *  @param [in]  shift holds p, the cleanup pass bitplane
+     *  @param [out] e receives E_n, or 0 for insignificant samples
+     *  @param [out] v receives v_n, or 0 for insignificant samples
+     *  @return a mask of the significant samples
+     */
+    OJPH_TARGET_AVX2 static inline
+    __m256i analyze_samples(__m256i t, __m128i shift, __m256i& e, __m256i& v)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i one = _mm256_set1_epi32(1);
+      __m256i val = _mm256_slli_epi32(t, 1);       //get rid of sign
+      val = _mm256_srl_epi32(val, shift);          //2 \mu_p + x
+      val = _mm256_andnot_si256(one, val);         //2 \mu_p
+      __m256i sig = _mm256_cmpeq_epi32(val, zero);
+      sig = _mm256_xor_si256(sig, _mm256_set1_epi32(-1));
+
+      //bits in 2\mu_p - 1 are 1 + bits in (2\mu_p - 1) >> 1
+      __m256i m = _mm256_srli_epi32(_mm256_sub_epi32(val, one), 1);
+      __m256i big = _mm256_cmpgt_epi32(m, _mm256_set1_epi32(0xFF));
+      m = _mm256_andnot_si256(_mm256_and_si256(big, _mm256_set1_epi32(0xFF)),
+                              m);
+      __m256i ex = _mm256_castps_si256(_mm256_cvtepi32_ps(m));
+      ex = _mm256_sub_epi32(_mm256_srli_epi32(ex, 23),
+                            _mm256_set1_epi32(126));
+      ex = _mm256_max_epi32(ex, zero);               //m == 0 has no bits
+      e = _mm256_and_si256(_mm256_add_epi32(ex, one), sig);
+
+      //v_n = 2(\mu_p-1) + s_n
+      __m256i vn = _mm256_sub_epi32(val, _mm256_set1_epi32(2));
+      vn = _mm256_add_epi32(vn, _mm256_srli_epi32(t, 31));
+      v = _mm256_and_si256(vn, sig);
+      return sig;
+    }
+
+    //************************************************************************/
+    /** @brief Stores the values of rows 0 and 1 of 8 columns, in quad order
+     *
+     *  @param [out] dp receives 16 values
+     *  @param [in]  r0 holds the values of the top row
+     *  @param [in]  r1 holds the values of the bottom row
+     */
+    OJPH_TARGET_AVX2 static inline
+    void store_quads(void* dp, __m256i r0, __m256i r1)
+    {
+      __m256i lo = _mm256_unpacklo_epi32(r0, r1);   //quads 0 and 2
+      __m256i hi = _mm256_unpackhi_epi32(r0, r1);   //quads 1 and 3
+      __m256i* p = (__m256i*)dp;
+      _mm256_storeu_si256(p, _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256(p + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    //************************************************************************/
+    /** @brief Finds rho and the largest E_n of 2 quads
+     *
+     *  @param [in]  sig is the significance of 8 samples, in quad order
+     *  @param [in]  e holds E_n of the same samples
+     *  @param [out] rho receives the significance of the 2 quads
+     *  @param [out] e_qmax receives the largest E_n of the 2 quads
+     */
+    OJPH_TARGET_AVX2 static inline
+    void quad_pair_stats(__m256i sig, __m256i e, ui8* rho, ui8* e_qmax)
+    {
+      int bits = _mm256_movemask_ps(_mm256_castsi256_ps(sig));
+      rho[0] = (ui8)(bits & 0xF);
+      rho[1] = (ui8)(bits >> 4);
+      __m256i mx = _mm256_max_epi32(e, _mm256_shuffle_epi32(e, 0x4E));
+      mx = _mm256_max_epi32(mx, _mm256_shuffle_epi32(mx, 0xB1));
+      e_qmax[0] = (ui8)_mm256_extract_epi32(mx, 0);
+      e_qmax[1] = (ui8)_mm256_extract_epi32(mx, 4);
+    }
+
+    //************************************************************************/
+    /** @brief Finds the distortion reduction of the cleanup pass for 8
+     *         samples
+     *
+     *  A significant sample goes from 0 to (\mu_p + 1/2) 2^p, which takes
+     *  q (2v - q) off its squared error, with q = \mu_p + 1/2 and v the
+     *  magnitude, both in units of 2^p.
+     *
+     *  @param [in]  t holds 8 samples in sign-magnitude form
+     *  @param [in]  shift holds p, the cleanup pass bitplane
+     *  @param [in]  scale is 2^{-p}
+     *  @return the reduction for each sample, 0 for insignificant ones
+     */
+    OJPH_TARGET_AVX2 static inline
+    __m256 sample_distortion(__m256i t, __m128i shift, __m256 scale)
+    {
+      __m256i mag = _mm256_and_si256(t, _mm256_set1_epi32(0x7FFFFFFF));
+      __m256i mu = _mm256_srl_epi32(mag, shift);
+      __m256 sig = _mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(mu, _mm256_setzero_si256()));
+      __m256 q = _mm256_add_ps(_mm256_cvtepi32_ps(mu), _mm256_set1_ps(0.5f));
+      __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(mag), scale);
+      __m256 d = _mm256_mul_ps(q, _mm256_sub_ps(_mm256_add_ps(v, v), q));
+      return _mm256_and_ps(d, sig);
+    }
+
+    //************************************************************************/
+    OJPH_TARGET_AVX2
+    void ojph_analyze_quad_row_avx2(const ui32* sp, ui32 stride,
+                                    ui32 width, bool two_rows, ui32 p,
+                                    quad_row_info* qr)
+    {
+      const __m128i shift = _mm_cvtsi32_si128((int)p);
+      const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+      const __m256 scale = _mm256_set1_ps(std::ldexp(1.0f, -(int)p));
+      __m256 dist = _mm256_setzero_ps();
+      for (ui32 x = 0; x < width; x += 8)
+      {
+        //columns beyond the width are not read, and end up as zeros
+        __m256i mask = _mm256_cmpgt_epi32(
+          _mm256_set1_epi32((int)(width - x)), lanes);
+        __m256i t0 = _mm256_maskload_epi32((const int*)(sp + x), mask);
+        __m256i t1 = _mm256_setzero_si256();
+        if (two_rows)
+          t1 = _mm256_maskload_epi32((const int*)(sp + stride + x), mask);
+
+        __m256i e0, e1, v0, v1;
+        __m256i sig0 = analyze_samples(t0, shift, e0, v0);
+        __m256i sig1 = analyze_samples(t1, shift, e1, v1);
+        dist = _mm256_add_ps(dist, sample_distortion(t0, shift, scale));
+        dist = _mm256_add_ps(dist, sample_distortion(t1, shift, scale));
+        store_quads(qr->e_q + 2 * x, e0, e1);
+        store_quads(qr->s + 2 * x, v0, v1);
+
+        //the statistics of the quads, again in quad order
+        __m256i sig_lo = _mm256_unpacklo_epi32(sig0, sig1);
+        __m256i sig_hi = _mm256_unpackhi_epi32(sig0, sig1);
+        __m256i e_lo = _mm256_unpacklo_epi32(e0, e1);
+        __m256i e_hi = _mm256_unpackhi_epi32(e0, e1);
+        quad_pair_stats(_mm256_permute2x128_si256(sig_lo, sig_hi, 0x20),
+                        _mm256_permute2x128_si256(e_lo, e_hi, 0x20),
+                        qr->rho + (x >> 1), qr->e_qmax + (x >> 1));
+        quad_pair_stats(_mm256_permute2x128_si256(sig_lo, sig_hi, 0x31),
+                        _mm256_permute2x128_si256(e_lo, e_hi, 0x31),
+                        qr->rho + (x >> 1) + 2, qr->e_qmax + (x >> 1) + 2);
+      }
+      __m128 d = _mm_add_ps(_mm256_castps256_ps128(dist),
+                            _mm256_extractf128_ps(dist, 1));
+      d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+      d = _mm_add_ss(d, _mm_movehdup_ps(d));
+      qr->dist = _mm_cvtss_f32(d);
+    }
+
+    //************************************************************************/
+    /** @brief ORs the 8 lanes of v together
+     */
+    OJPH_TARGET_AVX2 static inline
+    ui32 horizontal_or(__m256i v)
+    {
+      __m128i t = _mm_or_si128(_mm256_castsi256_si128(v),
+                               _mm256_extracti128_si256(v, 1));
+      t = _mm_or_si128(t, _mm_shuffle_epi32(t, 0x4E));
+      t = _mm_or_si128(t, _mm_shuffle_epi32(t, 0xB1));
+      return (ui32)_mm_cvtsi128_si32(t);
+    }
+
+    //************************************************************************/
+    OJPH_TARGET_AVX2
+    ui32 ojph_rev_tx_to_cb_avx2(const si32* src, ui32 src_stride,
+                                ui32* dest, ui32 width, ui32 height,
+                                ui32 shift)
+    {
+      const __m128i sh = _mm_cvtsi32_si128((int)shift);
+      const __m256i sign_bit = _mm256_set1_epi32(INT_MIN);
+      __m256i or_val = _mm256_setzero_si256();
+      ui32 tail_or = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride, dest += width)
+      {
+        ui32 x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+          __m256i t = _mm256_loadu_si256((const __m256i*)(src + x));
+          __m256i val = _mm256_sll_epi32(_mm256_abs_epi32(t), sh);
+          or_val = _mm256_or_si256(or_val, val);
+          val = _mm256_or_si256(val, _mm256_and_si256(t, sign_bit));
+          _mm256_storeu_si256((__m256i*)(dest + x), val);
+        }
+        if (x < width)
+          tail_or |= ojph_rev_tx_to_cb(src + x, 0, dest + x, width - x, 1,
+                                       shift);
+      }
+      return horizontal_or(or_val) | tail_or;
+    }
+
+    //************************************************************************/
+    OJPH_TARGET_AVX2
+    ui32 ojph_irv_tx_to_cb_avx2(const si32* src, ui32 src_stride,
+                                ui32* dest, ui32 width, ui32 height,
+                                float scale)
+    {
+      const __m256 sc = _mm256_set1_ps(scale);
+      const __m256 max_val = _mm256_set1_ps(2147483520.0f); //below 2^31
+      const __m256i sign_bit = _mm256_set1_epi32(INT_MIN);
+      __m256i or_val = _mm256_setzero_si256();
+      ui32 tail_or = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride, dest += width)
+      {
+        ui32 x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+          __m256i t = _mm256_loadu_si256((const __m256i*)(src + x));
+          __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(t), sc);
+          __m256i sign = _mm256_and_si256(_mm256_castps_si256(v), sign_bit);
+          v = _mm256_andnot_ps(_mm256_castsi256_ps(sign_bit), v);
+          __m256i val = _mm256_cvtps_epi32(_mm256_min_ps(v, max_val));
+          or_val = _mm256_or_si256(or_val, val);
+          _mm256_storeu_si256((__m256i*)(dest + x),
+                              _mm256_or_si256(val, sign));
+        }
+        if (x < width)
+          tail_or |= ojph_irv_tx_to_cb(src + x, 0, dest + x, width - x, 1,
+                                       scale);
+      }
+      return horizontal_or(or_val) | tail_or;
+    }
+  }
+}
+
+#endif // OJPH_ENABLE_INTEL_SIMD
@@ -0,0 +1,145 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    This source code incorporates work covered by the following license:
+ */
+// This software is released under the 2-Clause BSD license, included
+// below.
+//
+// Copyright (c) 2019, Aous Naman
+// Copyright (c) 2019, Kakadu Software Pty Ltd, Australia
+// Copyright (c) 2019, The University of New South Wales, Australia
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//***************************************************************************/
+// This file is part of the OpenJPH software implementation.
+// File: ojph_block_encoder.cpp
+// Author: Aous Naman
+// Date: 17 September 2019
+//***************************************************************************/
+
+//***************************************************************************/
+/** @file ojph_block_encoder_ssse3.cpp
+ *  @brief implements the sign-magnitude conversion of the HTJ2K block
+ *         encoder using SSSE3
+ */
+
+#include <climits>
+
+#include "ojph_arch.h"
+#include "ojph_block_encoder.h"
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+#include <immintrin.h>
+
+namespace ojph {
+  namespace local {
+
+    //************************************************************************/
+    /** @brief ORs the 4 lanes of v together
+     */
+    OJPH_TARGET_SSSE3 static inline
+    ui32 horizontal_or(__m128i v)
+    {
+      v = _mm_or_si128(v, _mm_shuffle_epi32(v, 0x4E));
+      v = _mm_or_si128(v, _mm_shuffle_epi32(v, 0xB1));
+      return (ui32)_mm_cvtsi128_si32(v);
+    }
+
+    //************************************************************************/
+    OJPH_TARGET_SSSE3
+    ui32 ojph_rev_tx_to_cb_ssse3(const si32* src, ui32 src_stride,
+                                 ui32* dest, ui32 width, ui32 height,
+                                 ui32 shift)
+    {
+      const __m128i sh = _mm_cvtsi32_si128((int)shift);
+      const __m128i sign_bit = _mm_set1_epi32(INT_MIN);
+      __m128i or_val = _mm_setzero_si128();
+      ui32 tail_or = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride, dest += width)
+      {
+        ui32 x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+          __m128i t = _mm_loadu_si128((const __m128i*)(src + x));
+          __m128i val = _mm_sll_epi32(_mm_abs_epi32(t), sh);
+          or_val = _mm_or_si128(or_val, val);
+          val = _mm_or_si128(val, _mm_and_si128(t, sign_bit));
+          _mm_storeu_si128((__m128i*)(dest + x), val);
+        }
+        if (x < width)
+          tail_or |= ojph_rev_tx_to_cb(src + x, 0, dest + x, width - x, 1,
+                                       shift);
+      }
+      return horizontal_or(or_val) | tail_or;
+    }
+
+    //************************************************************************/
+    OJPH_TARGET_SSSE3
+    ui32 ojph_irv_tx_to_cb_ssse3(const si32* src, ui32 src_stride,
+                                 ui32* dest, ui32 width, ui32 height,
+                                 float scale)
+    {
+      const __m128 sc = _mm_set1_ps(scale);
+      const __m128 max_val = _mm_set1_ps(2147483520.0f); //below 2^31
+      const __m128i sign_bit = _mm_set1_epi32(INT_MIN);
+      __m128i or_val = _mm_setzero_si128();
+      ui32 tail_or = 0;
+      for (ui32 y = 0; y < height; ++y, src += src_stride, dest += width)
+      {
+        ui32 x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+          __m128i t = _mm_loadu_si128((const __m128i*)(src + x));
+          __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(t), sc);
+          __m128i sign = _mm_and_si128(_mm_castps_si128(v), sign_bit);
+          v = _mm_andnot_ps(_mm_castsi128_ps(sign_bit), v);
+          __m128i val = _mm_cvtps_epi32(_mm_min_ps(v, max_val));
+          or_val = _mm_or_si128(or_val, val);
+          _mm_storeu_si128((__m128i*)(dest + x), _mm_or_si128(val, sign));
+        }
+        if (x < width)
+          tail_or |= ojph_irv_tx_to_cb(src + x, 0, dest + x, width - x, 1,
+                                       scale);
+      }
+      return horizontal_or(or_val) | tail_or;
+    }
+  }
+}
+
+#endif // OJPH_ENABLE_INTEL_SIMD
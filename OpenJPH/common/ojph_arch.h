@@ -74,6 +74,32 @@ namespace ojph {
 #define OJPH_OS_APPLE
 #elif (defined __linux)
 #define OJPH_OS_LINUX
+#endif
+
+  ////////////////////////////////////////////////////////////////////////////
+  //                      architecture detection definitions
+  ////////////////////////////////////////////////////////////////////////////
+#if (defined __i386__) || (defined __x86_64__) || (defined _M_IX86) \
+  || (defined _M_X64)
+#define OJPH_ARCH_X86
+#endif
+
+  ////////////////////////////////////////////////////////////////////////////
+  // SIMD code is compiled without special compiler flags; functions that use
+  // intrinsics carry a target attribute instead, and are only called after
+  // get_cpu_ext_level() confirms that the instructions are available.
+  // Defining OJPH_DISABLE_INTEL_SIMD leaves only the generic code paths.
+  ////////////////////////////////////////////////////////////////////////////
+#if (defined OJPH_ARCH_X86) && !(defined OJPH_DISABLE_INTEL_SIMD)
+#define OJPH_ENABLE_INTEL_SIMD
+#endif
+
+#ifdef OJPH_COMPILER_GNUC
+#define OJPH_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define OJPH_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define OJPH_TARGET_SSSE3
+#define OJPH_TARGET_AVX2
 #endif
 
   /////////////////////////////////////////////////////////////////////////////
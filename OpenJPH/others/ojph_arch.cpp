@@ -0,0 +1,157 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include "ojph_arch.h"
+
+namespace ojph {
+
+#ifdef OJPH_ENABLE_INTEL_SIMD
+
+  ////////////////////////////////////////////////////////////////////////////
+  // Executes the cpuid instruction for leaf eax and subleaf ecx; results
+  // are stored in abcd in the order eax, ebx, ecx, edx
+  static void run_cpuid(ui32 eax, ui32 ecx, ui32* abcd)
+  {
+  #ifdef OJPH_COMPILER_MSVC
+    __cpuidex((int *)abcd, (int)eax, (int)ecx);
+  #else
+    ui32 ebx = 0, edx = 0;
+  #if (defined __i386__) && (defined __PIC__)
+    // in case of PIC under 32-bit EBX cannot be clobbered
+    __asm__ ("movl %%ebx, %%edi \n\t cpuid \n\t xchgl %%ebx, %%edi"
+             : "=D" (ebx), "+a" (eax), "+c" (ecx), "=d" (edx));
+  #else
+    __asm__ ("cpuid" : "+b" (ebx), "+a" (eax), "+c" (ecx), "=d" (edx));
+  #endif
+    abcd[0] = eax; abcd[1] = ebx; abcd[2] = ecx; abcd[3] = edx;
+  #endif
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  // Reads extended control register index; the OS must have set OSXSAVE
+  static ui64 read_xcr(ui32 index)
+  {
+  #ifdef OJPH_COMPILER_MSVC
+    return _xgetbv(index);
+  #else
+    ui32 eax = 0, edx = 0;
+    __asm__ (".byte 0x0f, 0x01, 0xd0" // xgetbv
+             : "=a" (eax), "=d" (edx) : "c" (index));
+    return ((ui64)edx << 32) | eax;
+  #endif
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  static int init_cpu_ext_level()
+  {
+    ui32 abcd[4];
+    run_cpuid(0, 0, abcd);
+    ui32 max_leaf = abcd[0];
+
+    run_cpuid(1, 0, abcd);
+    ui32 ecx1 = abcd[2], edx1 = abcd[3];
+
+    int level = X86_CPU_EXT_LEVEL_GENERIC;
+    if ((edx1 & (1u << 23)) == 0) return level;  // MMX
+    level = X86_CPU_EXT_LEVEL_MMX;
+    if ((edx1 & (1u << 25)) == 0) return level;  // SSE
+    level = X86_CPU_EXT_LEVEL_SSE;
+    if ((edx1 & (1u << 26)) == 0) return level;  // SSE2
+    level = X86_CPU_EXT_LEVEL_SSE2;
+    if ((ecx1 & (1u << 0)) == 0) return level;   // SSE3
+    level = X86_CPU_EXT_LEVEL_SSE3;
+    if ((ecx1 & (1u << 9)) == 0) return level;   // SSSE3
+    level = X86_CPU_EXT_LEVEL_SSSE3;
+    if ((ecx1 & (1u << 19)) == 0) return level;  // SSE4.1
+    level = X86_CPU_EXT_LEVEL_SSE41;
+    if ((ecx1 & (1u << 20)) == 0) return level;  // SSE4.2
+    level = X86_CPU_EXT_LEVEL_SSE42;
+
+    // AVX needs both the instructions (bit 28) and OS support for saving
+    // the YMM registers, which is reported through OSXSAVE (bit 27)
+    if ((ecx1 & 0x18000000u) != 0x18000000u) return level;
+    ui64 xcr0 = read_xcr(0);
+    if ((xcr0 & 6) != 6) return level;
+    level = X86_CPU_EXT_LEVEL_AVX;
+
+    if (max_leaf < 7) return level;
+    run_cpuid(7, 0, abcd);
+    ui32 ebx7 = abcd[1];
+    if ((ebx7 & (1u << 5)) == 0) return level;   // AVX2
+    level = X86_CPU_EXT_LEVEL_AVX2;
+    if ((ecx1 & (1u << 12)) == 0) return level;  // FMA
+    level = X86_CPU_EXT_LEVEL_AVX2FMA;
+
+    // AVX512F and AVX512BW, with OS support for opmask and ZMM registers
+    if ((xcr0 & 0xE0) != 0xE0) return level;
+    if ((ebx7 & (1u << 16)) == 0 || (ebx7 & (1u << 30)) == 0) return level;
+    level = X86_CPU_EXT_LEVEL_AVX512;
+    return level;
+  }
+
+#else // !OJPH_ENABLE_INTEL_SIMD
+
+  ////////////////////////////////////////////////////////////////////////////
+  static int init_cpu_ext_level()
+  {
+    return X86_CPU_EXT_LEVEL_GENERIC;
+  }
+
+#endif // !OJPH_ENABLE_INTEL_SIMD
+
+  ////////////////////////////////////////////////////////////////////////////
+  // The environment variable HTJ2K_CPU_EXT_LEVEL caps the detected level, so
+  // that one binary can be made to run, or compared against, slower kernels.
+  // It takes a level name (generic, sse2, ssse3, avx2, ...) or its number;
+  // it cannot raise the level above what the CPU supports, and unrecognized
+  // values are ignored.
+  static int apply_forced_level(int level)
+  {
+    static const char* const names[] = {
+      "generic", "mmx", "sse", "sse2", "sse3", "ssse3", "sse41", "sse42",
+      "avx", "avx2", "avx2fma", "avx512"
+    };
+    const int num_names = (int)(sizeof(names) / sizeof(names[0]));
+
+    const char* env = getenv("HTJ2K_CPU_EXT_LEVEL");
+    if (env == NULL || *env == 0)
+      return level;
+
+    int forced = -1;
+    char* end = NULL;
+    long num = strtol(env, &end, 10);
+    if (*end == 0)
+      forced = (num >= 0 && num < num_names) ? (int)num : -1;
+    else
+      for (int i = 0; i < num_names; ++i)
+        if (strcmp(env, names[i]) == 0)
+          forced = i;
+
+    return (forced >= 0 && forced < level) ? forced : level;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  int get_cpu_ext_level()
+  {
+    static const int level = apply_forced_level(init_cpu_ext_level());
+    return level;
+  }
+
+}
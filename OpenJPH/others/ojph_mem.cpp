@@ -109,11 +109,16 @@ namespace ojph {
   void mem_elastic_allocator::get_buffer(ui32 needed_bytes, coded_lists* &p)
   {
     ui32 extended_bytes = needed_bytes + (ui32)sizeof(coded_lists);
+    // keeps the next coded_lists header aligned
+    extended_bytes = (extended_bytes + object_alignment - 1)
+                   & ~(object_alignment - 1);
 
     if (store == NULL)
     {
       ui32 bytes = ojph_max(extended_bytes, chunk_size);
       store = (stores_list*)malloc(bytes);
+      if (store == NULL)
+        throw "malloc failed";
       cur_store = store = new (store) stores_list(bytes);
       total_allocated += bytes;
     }
@@ -122,6 +127,8 @@ namespace ojph {
     {
       ui32 bytes = ojph_max(extended_bytes, chunk_size);
       cur_store->next_store = (stores_list*)malloc(bytes);
+      if (cur_store->next_store == NULL)
+        throw "malloc failed";
       cur_store = new (cur_store->next_store) stores_list(bytes);
       total_allocated += bytes;
     }
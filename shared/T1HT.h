@@ -0,0 +1,99 @@
+/*
+ *    Copyright (C) 2016-2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "grk_includes.h"
+
+// helpers shared by the HT block coder plugins
+namespace t1ht
+{
+// 5/3 and 9/7 synthesis norms, by subband orientation (LL, HL, LH, HH) and
+// DWT level; Grok's Part-1 T1 weights its wmsedec with the same tables
+inline constexpr double dwt_norms_53[4][10] = {
+	{1.000, 1.500, 2.750, 5.375, 10.68, 21.34, 42.67, 85.33, 170.7, 341.3},
+	{1.038, 1.592, 2.919, 5.703, 11.33, 22.64, 45.25, 90.48, 180.9},
+	{1.038, 1.592, 2.919, 5.703, 11.33, 22.64, 45.25, 90.48, 180.9},
+	{.7186, .9218, 1.586, 3.043, 6.019, 12.01, 24.00, 47.97, 95.93}};
+inline constexpr double dwt_norms_97[4][10] = {
+	{1.000, 1.965, 4.177, 8.403, 16.90, 33.84, 67.69, 135.3, 270.6, 540.9},
+	{2.022, 3.989, 8.355, 17.04, 34.27, 68.63, 137.3, 274.6, 549.0},
+	{2.022, 3.989, 8.355, 17.04, 34.27, 68.63, 137.3, 274.6, 549.0},
+	{2.080, 3.865, 8.307, 17.18, 34.71, 69.59, 139.3, 278.6, 557.2}};
+
+// factor from squared error in the samples of the block, in units of its
+// quantization step, to squared error in the image: the squared DWT norm of
+// its subband times the squared MCT norm of its component, as in Part-1
+inline double distortionWeight(const grk::CompressBlockExec* block)
+{
+	uint32_t orientation = block->bandOrientation;
+	assert(orientation < 4);
+	uint32_t level = (block->tile->comps + block->compno)->numresolutions - 1U - block->resno;
+	// levels past the end of the tables reuse their last entry
+	uint32_t max_level = orientation == 0 ? 9 : 8;
+	if(level > max_level)
+		level = max_level;
+	double norm = (block->qmfbid == 1 ? dwt_norms_53 : dwt_norms_97)[orientation][level];
+	if(block->mct_norms && block->compno < block->mct_numcomps)
+		norm *= block->mct_norms[block->compno];
+
+	return norm * norm * block->stepsize * block->stepsize;
+}
+
+// coding passes of a codeblock that the HT block decoders take
+struct HTSegments
+{
+	uint32_t num_passes;
+	uint32_t lengths1; // cleanup pass
+	uint32_t lengths2; // SigProp and MagRef passes
+};
+// the first segment holds the cleanup pass and the second one the SigProp
+// and MagRef passes; passes of later HT sets are not decoded, and a block
+// without cleanup data has no passes. Returns false, after reporting the
+// error, if the segments claim more bytes than the codeblock holds.
+inline bool getHTSegments(grk::DecompressBlockExec* block, HTSegments& segments)
+{
+	auto cblk = block->cblk;
+	segments = {0, 0, 0};
+	uint32_t num_segments = cblk->getNumSegments();
+	if(num_segments > 0)
+	{
+		auto sgrk = cblk->getSegment(0);
+		segments.num_passes = sgrk->numpasses;
+		segments.lengths1 = sgrk->len;
+	}
+	if(num_segments > 1 && segments.num_passes == 1)
+	{
+		auto sgrk = cblk->getSegment(1);
+		segments.num_passes += std::min<uint32_t>(sgrk->numpasses, 2);
+		segments.lengths2 = sgrk->len;
+	}
+	if((size_t)segments.lengths1 + segments.lengths2 > cblk->getSegBuffersLen())
+	{
+		grk::GRK_ERROR("HT segment lengths exceed the codeblock data");
+		return false;
+	}
+	if(!segments.lengths1)
+		segments.num_passes = 0;
+
+	return true;
+}
+} // namespace t1ht